@@ -0,0 +1,199 @@
+#include "./arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// every allocation is rounded up to this alignment
+#define ARENA_ALIGN 16
+
+// chunks malloc'd by every arena so far
+static size_t chunk_mallocs = 0;
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;  // usable bytes in data
+    size_t used;
+    unsigned char data[];
+};
+typedef struct arena_chunk arena_chunk_t;
+
+// head is the first chunk, allocation happens in current
+// chunks after current are kept from earlier use and reused before new ones
+// are malloc'd
+struct arena {
+    arena_chunk_t *head;
+    arena_chunk_t *current;
+    size_t chunk_size;
+    void *last;  // most recent allocation, for arena_grow
+};
+
+/*
+ * rounds size up to ARENA_ALIGN
+ */
+static size_t align_size(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+/*
+ * mallocs a new empty chunk
+ *
+ * size - usable bytes in the chunk
+ * returns pointer, NULL on failure
+ */
+static arena_chunk_t *new_chunk(size_t size) {
+    arena_chunk_t *chunk =
+        (arena_chunk_t *)malloc(sizeof(arena_chunk_t) + size);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk_mallocs++;
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+/*
+ * initializes an arena whose chunks hold at least chunk_size bytes
+ * returns pointer, NULL on failure
+ */
+arena_t *init_arena(size_t chunk_size) {
+    arena_t *arena = (arena_t *)malloc(sizeof(arena_t));
+    if (arena == NULL) {
+        return NULL;
+    }
+
+    arena->chunk_size = align_size(chunk_size);
+    arena->head = new_chunk(arena->chunk_size);
+    if (arena->head == NULL) {
+        free(arena);
+        return NULL;
+    }
+    arena->current = arena->head;
+    arena->last = NULL;
+    return arena;
+}
+
+/*
+ * cleans up arena and every chunk it owns
+ * Note: this function will free the arena pointer
+ * DO NOT use the pointer or any memory allocated from it afterwards
+ */
+void cleanup_arena(arena_t *arena) {
+    if (arena == NULL) {
+        return;
+    }
+
+    arena_chunk_t *cur = arena->head;
+    while (cur != NULL) {
+        arena_chunk_t *next = cur->next;
+        free(cur);
+        cur = next;
+    }
+    free(arena);
+}
+
+/* allocates size bytes from arena, returns pointer or NULL on failure */
+void *arena_alloc(arena_t *arena, size_t size) {
+    if (arena == NULL) {
+        return NULL;
+    }
+
+    size = align_size(size);
+    arena_chunk_t *chunk = arena->current;
+    if (chunk->size - chunk->used < size) {
+        // move on to the next kept chunk if it is big enough, otherwise
+        // insert a fresh one after current
+        arena_chunk_t *next = chunk->next;
+        if (next == NULL || next->size < size) {
+            size_t chunk_size =
+                size > arena->chunk_size ? size : arena->chunk_size;
+            arena_chunk_t *fresh = new_chunk(chunk_size);
+            if (fresh == NULL) {
+                return NULL;
+            }
+            fresh->next = next;
+            chunk->next = fresh;
+            next = fresh;
+        }
+        next->used = 0;
+        arena->current = next;
+        chunk = next;
+    }
+
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->last = ptr;
+    return ptr;
+}
+
+/*
+ * grows an allocation from old_size to new_size bytes
+ * extends in place when ptr is the most recent allocation, otherwise copies
+ * returns pointer to the grown block or NULL on failure
+ */
+void *arena_grow(arena_t *arena, void *ptr, size_t old_size, size_t new_size) {
+    if (arena == NULL) {
+        return NULL;
+    }
+    if (ptr == NULL) {
+        return arena_alloc(arena, new_size);
+    }
+    if (new_size <= old_size) {
+        return ptr;
+    }
+
+    arena_chunk_t *chunk = arena->current;
+    if (ptr == arena->last) {
+        size_t start = (size_t)((unsigned char *)ptr - chunk->data);
+        size_t size = align_size(new_size);
+        if (chunk->size - start >= size) {
+            chunk->used = start + size;
+            return ptr;
+        }
+    }
+
+    void *grown = arena_alloc(arena, new_size);
+    if (grown == NULL) {
+        return NULL;
+    }
+    memcpy(grown, ptr, old_size);
+    return grown;
+}
+
+/* gets current position of arena */
+arena_mark_t arena_mark(arena_t *arena) {
+    arena_mark_t mark = {NULL, 0};
+    if (arena != NULL) {
+        mark.chunk = arena->current;
+        mark.used = arena->current->used;
+    }
+    return mark;
+}
+
+/* frees everything allocated since mark was taken, chunks are kept */
+void arena_release(arena_t *arena, arena_mark_t mark) {
+    if (arena == NULL || mark.chunk == NULL) {
+        return;
+    }
+
+    arena->current = (arena_chunk_t *)mark.chunk;
+    arena->current->used = mark.used;
+    arena->last = NULL;
+}
+
+/* frees everything allocated from arena, chunks are kept */
+void arena_reset(arena_t *arena) {
+    if (arena == NULL) {
+        return;
+    }
+
+    arena->current = arena->head;
+    arena->head->used = 0;
+    arena->last = NULL;
+}
+
+/* gets number of chunks malloc'd by every arena so far */
+size_t arena_malloc_count(void) {
+    return chunk_mallocs;
+}
@@ -0,0 +1,45 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+
+typedef struct arena arena_t;
+
+/* position in an arena, used to free everything allocated after it */
+typedef struct arena_mark {
+    void *chunk;
+    size_t used;
+} arena_mark_t;
+
+/*
+ * initializes an arena whose chunks hold at least chunk_size bytes
+ * returns pointer, NULL on failure
+ */
+arena_t *init_arena(size_t chunk_size);
+/*
+ * cleans up arena and every chunk it owns
+ * Note: this function will free the arena pointer
+ * DO NOT use the pointer or any memory allocated from it afterwards
+ */
+void cleanup_arena(arena_t *arena);
+
+/* allocates size bytes from arena, returns pointer or NULL on failure */
+void *arena_alloc(arena_t *arena, size_t size);
+/*
+ * grows an allocation from old_size to new_size bytes
+ * extends in place when ptr is the most recent allocation, otherwise copies
+ * returns pointer to the grown block or NULL on failure
+ */
+void *arena_grow(arena_t *arena, void *ptr, size_t old_size, size_t new_size);
+
+/* gets current position of arena */
+arena_mark_t arena_mark(arena_t *arena);
+/* frees everything allocated since mark was taken, chunks are kept */
+void arena_release(arena_t *arena, arena_mark_t mark);
+/* frees everything allocated from arena, chunks are kept */
+void arena_reset(arena_t *arena);
+
+/* gets number of chunks malloc'd by every arena so far */
+size_t arena_malloc_count(void);
+
+#endif  // ARENA_H_
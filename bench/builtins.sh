@@ -0,0 +1,23 @@
+#!/bin/bash
+# builtins against the programs they replace: RUNS lines of each command
+# with output to /dev/null, run as a builtin and from /usr/bin
+. "$(dirname "$0")/lib.bash"
+RUNS=${RUNS:-2000}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+lines() {
+    "$SH" < "$dir/script"
+}
+
+echo "builtins, $RUNS lines each:"
+for command in "echo hello world" "printf '%s\n' hello" "true" \
+               "test 1 -eq 1" "[ -d /tmp ]"; do
+    for prefix in "" /usr/bin/; do
+        for ((i = 0; i < RUNS; i++)); do
+            echo "$prefix$command > /dev/null"
+        done > "$dir/script"
+        measure "${prefix:-builtin }$command" "$RUNS" lines
+    done
+done
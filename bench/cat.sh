@@ -0,0 +1,45 @@
+#!/bin/bash
+# cat throughput: a SIZE-byte file copied to a file, a pipe and /dev/null
+# by the cat builtin and /usr/bin/cat, then RUNS cats of a small file
+. "$(dirname "$0")/lib.bash"
+SIZE=${SIZE:-$((1 << 30))}
+RUNS=${RUNS:-2000}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+head -c "$SIZE" /dev/zero > "$dir/big"
+echo small > "$dir/small"
+for ((i = 0; i < RUNS; i++)); do
+    echo "cat $dir/small > /dev/null"
+done > "$dir/builtin"
+sed 's|^cat|/usr/bin/cat|' "$dir/builtin" > "$dir/external"
+
+run() {
+    "$SH" -c "$1 $dir/big $2"
+}
+
+lines() {
+    "$SH" < "$dir/$1"
+}
+
+# each copy to a file starts with nothing left to write back, after one
+# untimed copy, since otherwise whichever runs first is slower
+run /usr/bin/cat "> $dir/out"
+rm -f "$dir/out"
+echo "cat, $SIZE bytes:"
+sync
+measure_rate "builtin cat big > file" "$SIZE" run cat "> $dir/out"
+rm -f "$dir/out"
+sync
+measure_rate "/usr/bin/cat big > file" "$SIZE" run /usr/bin/cat "> $dir/out"
+rm -f "$dir/out"
+measure_rate "builtin cat big | wc -c" "$SIZE" run cat "| wc -c > /dev/null"
+measure_rate "/usr/bin/cat big | wc -c" "$SIZE" \
+    run /usr/bin/cat "| wc -c > /dev/null"
+measure_rate "builtin cat big > /dev/null" "$SIZE" run cat "> /dev/null"
+measure_rate "/usr/bin/cat big > /dev/null" "$SIZE" \
+    run /usr/bin/cat "> /dev/null"
+
+echo "cat small > /dev/null, $RUNS lines:"
+measure "builtin cat" "$RUNS" lines builtin
+measure "/usr/bin/cat" "$RUNS" lines external
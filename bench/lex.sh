@@ -0,0 +1,8 @@
+#!/bin/bash
+# lexer throughput against strtok, with the lexer built with and without
+# its SSE2 scan
+. "$(dirname "$0")/lib.bash"
+
+echo "lexer, 1.1 MB line of 95-byte paths:"
+"$ROOT/bench/lex_bench"
+"$ROOT/bench/lex_bench_scalar" | tail -n 1
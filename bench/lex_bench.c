@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../lex.h"
+
+#define LINE_SIZE (1100 * 1024)  // bytes of the generated line
+#define ITERATIONS 200           // passes over the line per method, of
+                                 // which the fastest is reported
+
+/*
+ * gets the time of a monotonic clock in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * splits the line on whitespace with strtok, as parse() used to
+ *
+ * returns number of words
+ */
+static size_t split_strtok(char *line) {
+    size_t words = 0;
+    for (char *word = strtok(line, " \t\n"); word;
+         word = strtok(NULL, " \t\n")) {
+        words++;
+    }
+    return words;
+}
+
+/*
+ * splits the line into tokens with the lexer
+ *
+ * returns number of words
+ */
+static size_t split_lexer(char *line, size_t length) {
+    lexer_t lexer;
+    token_t token;
+    size_t words = 0;
+    init_lexer(&lexer, line, length);
+    while (next_token(&lexer, &token) == 0 && token.type != TOKEN_END) {
+        words++;
+    }
+    return words;
+}
+
+/*
+ * lexer throughput: a long line of 95-byte paths split ITERATIONS times
+ * by strtok and by the lexer, which is built with or without SSE2; the
+ * fastest pass of each is reported, since the slower ones mostly measure
+ * noise
+ */
+int main(void) {
+    char *source = malloc(LINE_SIZE + 1);
+    char *line = malloc(LINE_SIZE + 1);
+    if (!source || !line) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return 1;
+    }
+    size_t length = 0;
+    for (unsigned i = 0; length + 96 <= LINE_SIZE; i++) {
+        length += (size_t)sprintf(source + length,
+                                  "/usr/local/share/applications/data/"
+                                  "project/module%08u/src/components/"
+                                  "files/archive/item.txt ", i);
+    }
+    source[length] = '\0';
+
+    size_t words[2] = {0, 0};
+    double seconds[2] = {1e9, 1e9};
+    for (int method = 0; method < 2; method++) {
+        for (int i = 0; i < ITERATIONS; i++) {
+            memcpy(line, source, length + 1);
+            double start = now();
+            words[method] += method == 0 ? split_strtok(line)
+                                         : split_lexer(line, length);
+            double elapsed = now() - start;
+            if (elapsed < seconds[method]) {
+                seconds[method] = elapsed;
+            }
+        }
+    }
+    if (words[0] != words[1]) {
+        fprintf(stderr, "ERROR: strtok found %zu words, the lexer %zu\n",
+                words[0], words[1]);
+        return 1;
+    }
+
+    double megabytes = (double)length / 1e6;
+#ifdef __SSE2__
+    const char *build = "SSE2";
+#else
+    const char *build = "scalar";
+#endif
+    printf("  strtok                  %8.0f MB/s\n", megabytes / seconds[0]);
+    printf("  lexer, %-16s %8.0f MB/s\n", build, megabytes / seconds[1]);
+    free(source);
+    free(line);
+    return 0;
+}
@@ -0,0 +1,31 @@
+# helpers shared by the bench scripts, which make bench runs from the
+# repo root; SH picks the shell under test
+
+ROOT=$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)
+SH=${SH:-$ROOT/33noprompt}
+
+# runs a command and prints its wall time, total and per run
+# usage: measure label runs command...
+measure() {
+    local label=$1 runs=$2
+    shift 2
+    local start=$EPOCHREALTIME
+    "$@"
+    local end=$EPOCHREALTIME
+    LABEL=$label awk -v start="$start" -v end="$end" -v runs="$runs" \
+        'BEGIN { printf "  %-40s %8.3f s %10.1f us/run\n", ENVIRON["LABEL"],
+                 end - start, (end - start) * 1e6 / runs }'
+}
+
+# runs a command that moves bytes and prints its throughput
+# usage: measure_rate label bytes command...
+measure_rate() {
+    local label=$1 bytes=$2
+    shift 2
+    local start=$EPOCHREALTIME
+    "$@"
+    local end=$EPOCHREALTIME
+    LABEL=$label awk -v start="$start" -v end="$end" -v bytes="$bytes" \
+        'BEGIN { printf "  %-40s %8.3f s %8.2f GB/s\n", ENVIRON["LABEL"],
+                 end - start, bytes / (end - start) / 1e9 }'
+}
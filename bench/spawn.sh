@@ -0,0 +1,21 @@
+#!/bin/bash
+# launch latency: fork and exec against posix_spawn at several resident
+# sizes, then RUNS /bin/true lines through the shell
+. "$(dirname "$0")/lib.bash"
+RUNS=${RUNS:-2000}
+
+echo "launch of /bin/true, 500 runs per size:"
+"$ROOT/bench/spawn_bench"
+
+script=$(mktemp)
+trap 'rm -f "$script"' EXIT
+for ((i = 0; i < RUNS; i++)); do
+    echo /bin/true
+done > "$script"
+
+launch_lines() {
+    "$SH" < "$script"
+}
+
+echo "through the shell, $RUNS lines on stdin:"
+measure "/bin/true" "$RUNS" launch_lines
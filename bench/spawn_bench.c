@@ -0,0 +1,84 @@
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUNS 500  // launches per method and size
+
+extern char **environ;
+
+/*
+ * gets the time of a monotonic clock in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * runs /bin/true RUNS times and waits for each
+ *
+ * spawn - 1 for posix_spawn, 0 for fork and exec
+ * returns microseconds per launch, -1 on error
+ */
+static double launch(int spawn) {
+    char *argv[] = {"true", NULL};
+    double start = now();
+    for (int i = 0; i < RUNS; i++) {
+        pid_t pid;
+        if (spawn) {
+            if (posix_spawn(&pid, "/bin/true", NULL, NULL, argv, environ)) {
+                return -1;
+            }
+        } else if ((pid = fork()) == 0) {
+            execve("/bin/true", argv, environ);
+            _exit(127);
+        } else if (pid < 0) {
+            return -1;
+        }
+        if (waitpid(pid, NULL, 0) < 0) {
+            return -1;
+        }
+    }
+    return (now() - start) * 1e6 / RUNS;
+}
+
+/*
+ * launch latency of fork and exec against posix_spawn, with the caller
+ * holding 0, 64 and 512 MB of touched memory, since fork copies the
+ * caller's page tables and posix_spawn does not; the memory is kept out
+ * of huge pages, like most of a long-running shell's heap
+ */
+int main(void) {
+    const size_t sizes[] = {0, 64, 512};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t bytes = sizes[i] << 20;
+        char *memory = NULL;
+        if (bytes) {
+            memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) {
+                perror("mmap");
+                return 1;
+            }
+            madvise(memory, bytes, MADV_NOHUGEPAGE);
+            memset(memory, 1, bytes);
+        }
+        double forked = launch(0);
+        double spawned = launch(1);
+        if (memory) {
+            munmap(memory, bytes);
+        }
+        if (forked < 0 || spawned < 0) {
+            perror("launch");
+            return 1;
+        }
+        printf("  RSS %3zu MB: fork+exec %7.0f us   posix_spawn %7.0f us\n",
+               sizes[i], forked, spawned);
+    }
+    return 0;
+}
@@ -0,0 +1,21 @@
+#!/bin/bash
+# startup latency: RUNS shells that each run one builtin and exit, given
+# the line on stdin and with -c
+. "$(dirname "$0")/lib.bash"
+RUNS=${RUNS:-2000}
+
+piped() {
+    for ((i = 0; i < RUNS; i++)); do
+        "$SH" <<< 'cd .'
+    done
+}
+
+command_string() {
+    for ((i = 0; i < RUNS; i++)); do
+        "$SH" -c 'cd .'
+    done
+}
+
+echo "startup, $RUNS runs of one builtin:"
+measure "command on stdin" "$RUNS" piped
+measure "-c 'cd .'" "$RUNS" command_string
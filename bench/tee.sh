@@ -0,0 +1,19 @@
+#!/bin/bash
+# tee throughput: SIZE bytes through head -c | tee SINK | cat, with the
+# tee builtin and with /usr/bin/tee, into /dev/null and into a file
+. "$(dirname "$0")/lib.bash"
+SIZE=${SIZE:-$((1 << 30))}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+run() {
+    "$SH" -c "head -c $SIZE /dev/zero | $1 $2 | cat > /dev/null"
+}
+
+echo "tee, $SIZE bytes:"
+measure_rate "builtin tee -> /dev/null" "$SIZE" run tee /dev/null
+measure_rate "/usr/bin/tee -> /dev/null" "$SIZE" run /usr/bin/tee /dev/null
+measure_rate "builtin tee -> file" "$SIZE" run tee "$dir/out"
+rm -f "$dir/out"
+measure_rate "/usr/bin/tee -> file" "$SIZE" run /usr/bin/tee "$dir/out"
@@ -0,0 +1,40 @@
+#!/bin/bash
+# tree operations: cp -r and rm -r of FILES files spread over DIRS
+# directories, by the cp and rm builtins and by /bin/cp and /bin/rm
+. "$(dirname "$0")/lib.bash"
+FILES=${FILES:-100000}
+DIRS=${DIRS:-100}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+mkdir "$dir/template"
+for ((d = 0; d < DIRS; d++)); do
+    mkdir "$dir/template/d$d"
+    seq -f "$dir/template/d$d/f%g" $((FILES / DIRS)) | xargs touch
+done
+
+# a fresh copy of the tree, written back so it does not slow the timing
+fresh() {
+    /bin/cp -r "$dir/template" "$dir/tree"
+    sync
+}
+
+run() {
+    "$SH" -c "$1 $dir/tree"
+}
+
+copy() {
+    "$SH" -c "$1 $dir/template $dir/tree"
+    sync
+}
+
+echo "tree of $FILES files in $DIRS directories:"
+sync
+measure "builtin cp -r" 1 copy "cp -r"
+/bin/rm -r "$dir/tree"
+measure "/bin/cp -r" 1 copy "/bin/cp -r"
+/bin/rm -r "$dir/tree"
+fresh
+measure "builtin rm -r" 1 run "rm -r"
+fresh
+measure "/bin/rm -r" 1 run "/bin/rm -r"
@@ -0,0 +1,885 @@
+#include "./copy.h"
+#include "./getdents.h"
+#include "./pool.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define COPY_BUFFER_SIZE 65536          // chunk of the read and write paths
+#define SPLICE_CHUNK ((size_t)1 << 30)  // most bytes asked of one splice
+#define TREE_MAX_THREADS 16             // most threads one copy_tree starts
+
+// how data reaches one output
+enum sink_kind {
+    SINK_PIPE,    // tee(2) can write it directly
+    SINK_SPLICE,  // data is spliced into it from a pipe
+    SINK_COPY     // data is read from a pipe and written, since splice
+                  // refuses O_APPEND files
+};
+
+// ways the kernel can copy between two fds without user space
+enum copy_method {
+    COPY_RANGE,  // copy_file_range(2), between regular files
+    SEND_FILE,   // sendfile(2), from a regular file
+    SPLICE       // splice(2), to or from a pipe
+};
+
+// pipes and buffers of one tee_stream call
+// the outputs are fed from source, which is in_fd itself when it is a pipe
+// and source_pipe otherwise; outputs other than the first that tee(2)
+// copies to go through spare, which is emptied after every copy
+struct tee_state {
+    int in_fd;
+    const int *out_fds;
+    size_t count;
+    enum sink_kind *kinds;
+    size_t consumer;  // output the data is finally moved into
+    int source;
+    int source_pipe[2];
+    int spare[2];
+    char *buffer;  // COPY_BUFFER_SIZE bytes
+};
+
+/*
+ * works out how data can reach an output fd
+ */
+static enum sink_kind get_sink_kind(int fd) {
+    struct stat st;
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fstat(fd, &st) < 0 || (flags & O_APPEND)) {
+        return SINK_COPY;
+    }
+    if (S_ISFIFO(st.st_mode)) {
+        return SINK_PIPE;
+    }
+    if (S_ISREG(st.st_mode) || S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode) ||
+        S_ISSOCK(st.st_mode)) {
+        return SINK_SPLICE;
+    }
+    return SINK_COPY;
+}
+
+/*
+ * writes all of a buffer, retrying short writes
+ *
+ * returns 0 on success, -1 on error
+ */
+static int write_all(int fd, const char *buffer, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, buffer, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buffer += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+/*
+ * moves bytes out of a pipe into an output
+ *
+ * pipe_fd - read end of a pipe holding at least length bytes
+ * fd - output
+ * kind - how data reaches fd
+ * length - bytes to move
+ * buffer - COPY_BUFFER_SIZE bytes, used for SINK_COPY
+ * returns 0 on success, -1 on error
+ */
+static int drain_pipe(int pipe_fd, int fd, enum sink_kind kind, size_t length,
+                      char *buffer) {
+    while (length > 0) {
+        ssize_t moved;
+        if (kind == SINK_COPY) {
+            moved = read(pipe_fd, buffer,
+                         length < COPY_BUFFER_SIZE ? length : COPY_BUFFER_SIZE);
+            if (moved > 0 && write_all(fd, buffer, (size_t)moved) < 0) {
+                return -1;
+            }
+        } else {
+            moved = splice(pipe_fd, NULL, fd, NULL, length, SPLICE_F_MOVE);
+        }
+        if (moved < 0 && errno == EINTR) {
+            continue;
+        }
+        if (moved <= 0) {
+            if (moved == 0) {
+                // the pipe held less than tee said it copied
+                errno = EIO;
+            }
+            return -1;
+        }
+        length -= (size_t)moved;
+    }
+    return 0;
+}
+
+/*
+ * copies in_fd to every output through a buffer, for inputs and outputs
+ * the kernel cannot move data between
+ *
+ * buffer - COPY_BUFFER_SIZE bytes
+ * returns 0 on success, -1 on error
+ */
+static int copy_buffered(int in_fd, const int *out_fds, size_t count,
+                         char *buffer) {
+    while (1) {
+        ssize_t got = read(in_fd, buffer, COPY_BUFFER_SIZE);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return (int)got;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (write_all(out_fds[i], buffer, (size_t)got) < 0) {
+                return -1;
+            }
+        }
+    }
+}
+
+/*
+ * copies all of a tee_stream's input through its buffer instead
+ */
+static int tee_buffered(const struct tee_state *state) {
+    return copy_buffered(state->in_fd, state->out_fds, state->count,
+                         state->buffer);
+}
+
+/*
+ * moves one round of data from the source to the consumer when it is the
+ * only output
+ *
+ * returns bytes moved, 0 at end of file, -1 on error
+ */
+static ssize_t move_to_consumer(const struct tee_state *state) {
+    int fd = state->out_fds[state->consumer];
+    if (state->kinds[state->consumer] != SINK_COPY) {
+        return splice(state->source, NULL, fd, NULL, SPLICE_CHUNK,
+                      SPLICE_F_MOVE);
+    }
+    ssize_t got = read(state->source, state->buffer, COPY_BUFFER_SIZE);
+    if (got > 0 && write_all(fd, state->buffer, (size_t)got) < 0) {
+        return -1;
+    }
+    return got;
+}
+
+/*
+ * copies the input to every output, one pipe buffer's worth at a time
+ * the first output that is a pipe gets the data with one tee(2); the others
+ * but the consumer are fed through spare, and the consumer finally takes
+ * the data out of the source
+ *
+ * returns 0 at end of file, -1 on error
+ */
+static int run_tee(struct tee_state *state) {
+    int moved_any = 0;
+
+    while (1) {
+        size_t length = 0;  // bytes in this round, 0 until it is known
+        if (state->source != state->in_fd) {
+            ssize_t got = splice(state->in_fd, NULL, state->source_pipe[1],
+                                 NULL, SPLICE_CHUNK, SPLICE_F_MOVE);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0 && errno == EINVAL && !moved_any) {
+                return tee_buffered(state);
+            }
+            if (got <= 0) {
+                return (int)got;
+            }
+            length = (size_t)got;
+        }
+
+        // a direct tee into an output pipe may copy less than asked, so it
+        // is only used while the length of the round is still open
+        int direct = length == 0;
+        for (size_t i = 0; i < state->count; i++) {
+            if (i == state->consumer) {
+                continue;
+            }
+            int target = direct && state->kinds[i] == SINK_PIPE
+                             ? state->out_fds[i]
+                             : state->spare[1];
+            ssize_t got;
+            do {
+                got = tee(state->source, target,
+                          length ? length : SPLICE_CHUNK, 0);
+            } while (got < 0 && errno == EINTR);
+            if (got < 0 && errno == EINVAL && !moved_any) {
+                return tee_buffered(state);
+            }
+            if (got <= 0) {
+                return (int)got;
+            }
+            if (length && (size_t)got != length) {
+                errno = EIO;
+                return -1;
+            }
+            length = (size_t)got;
+            if (target == state->spare[1] &&
+                drain_pipe(state->spare[0], state->out_fds[i],
+                           state->kinds[i], length, state->buffer) < 0) {
+                return -1;
+            }
+            direct = 0;
+            moved_any = 1;
+        }
+
+        if (length == 0) {
+            ssize_t got = move_to_consumer(state);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0 && errno == EINVAL && !moved_any) {
+                return tee_buffered(state);
+            }
+            if (got <= 0) {
+                return (int)got;
+            }
+        } else if (drain_pipe(state->source, state->out_fds[state->consumer],
+                              state->kinds[state->consumer], length,
+                              state->buffer) < 0) {
+            return -1;
+        }
+        moved_any = 1;
+    }
+}
+
+/*
+ * copies everything read from in_fd to each of out_fds until end of file
+ * when the data can stay in the kernel it never enters user space: tee(2)
+ * duplicates pipe buffers for all outputs but one, and splice(2) moves the
+ * data into the last; O_APPEND outputs, which splice refuses, are written
+ * from a buffer instead
+ *
+ * in_fd - fd to read
+ * out_fds - fds to write, at least one
+ * count - number of out_fds
+ * returns 0 on success, -1 on error with errno set
+ */
+int tee_stream(int in_fd, const int *out_fds, size_t count) {
+    struct tee_state state = {in_fd, out_fds, count, NULL, 0, in_fd,
+                              {-1, -1},  {-1, -1}, NULL};
+    struct stat st;
+    int status = -1;
+
+    if (count == 0 || fstat(in_fd, &st) < 0) {
+        errno = count == 0 ? EINVAL : errno;
+        return -1;
+    }
+
+    state.kinds = malloc(count * sizeof(enum sink_kind));
+    state.buffer = malloc(COPY_BUFFER_SIZE);
+    if (state.kinds && state.buffer) {
+        // the data is finally moved into an output splice can write, so the
+        // O_APPEND ones only ever get copies
+        state.consumer = count;
+        for (size_t i = 0; i < count; i++) {
+            state.kinds[i] = get_sink_kind(out_fds[i]);
+            if (state.consumer == count && state.kinds[i] != SINK_COPY) {
+                state.consumer = i;
+            }
+        }
+        if (state.consumer == count) {
+            state.consumer = 0;
+        }
+
+        // inputs that are not pipes are spliced into one first, so tee(2)
+        // has pipe buffers to duplicate
+        status = 0;
+        if (!S_ISFIFO(st.st_mode)) {
+            status = pipe2(state.source_pipe, O_CLOEXEC);
+            state.source = state.source_pipe[0];
+        }
+
+        // spare holds whole rounds, so it is as large as the source
+        if (status == 0 && count > 1 &&
+            (status = pipe2(state.spare, O_CLOEXEC)) == 0) {
+            int size = fcntl(state.source, F_GETPIPE_SZ);
+            if (size > 0) {
+                fcntl(state.spare[1], F_SETPIPE_SZ, size);
+            }
+        }
+        if (status == 0) {
+            status = run_tee(&state);
+        }
+    }
+
+    int error = errno;
+    for (int i = 0; i < 2; i++) {
+        if (state.source_pipe[i] >= 0) {
+            close(state.source_pipe[i]);
+        }
+        if (state.spare[i] >= 0) {
+            close(state.spare[i]);
+        }
+    }
+    free(state.kinds);
+    free(state.buffer);
+    errno = error;
+    return status;
+}
+
+/*
+ * copies the rest of in_fd to out_fd with one way of moving data in the
+ * kernel
+ * every method reads and writes at the fds' file positions, so another one
+ * can carry on from wherever this one stopped
+ *
+ * method - COPY_RANGE, SEND_FILE or SPLICE
+ * returns 0 at end of file, 1 if the kernel refused this method for these
+ * fds, -1 on error
+ */
+static int kernel_copy(enum copy_method method, int in_fd, int out_fd) {
+    while (1) {
+        ssize_t moved;
+        if (method == COPY_RANGE) {
+            moved = copy_file_range(in_fd, NULL, out_fd, NULL, SPLICE_CHUNK, 0);
+        } else if (method == SEND_FILE) {
+            moved = sendfile(out_fd, in_fd, NULL, SPLICE_CHUNK);
+        } else {
+            moved = splice(in_fd, NULL, out_fd, NULL, SPLICE_CHUNK,
+                           SPLICE_F_MOVE);
+        }
+        if (moved > 0) {
+            continue;
+        }
+        if (moved == 0) {
+            return 0;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EINVAL || errno == ENOSYS || errno == EXDEV ||
+            errno == EOPNOTSUPP || errno == EBADF) {
+            return 1;
+        }
+        return -1;
+    }
+}
+
+/*
+ * copies everything left in in_fd to out_fd
+ * the kernel moves the data when it can: copy_file_range(2) between
+ * regular files, which may share blocks on filesystems that support it,
+ * sendfile(2) from a regular file to anything else, and splice(2) when
+ * either side is a pipe; whatever the kernel refuses, such as O_APPEND
+ * outputs, goes through read and write
+ *
+ * in_fd - fd to read
+ * out_fd - fd to write
+ * returns 0 on success, -1 on error with errno set
+ */
+int copy_fd(int in_fd, int out_fd) {
+    struct stat in_st;
+    struct stat out_st;
+    if (fstat(in_fd, &in_st) < 0 || fstat(out_fd, &out_st) < 0) {
+        return -1;
+    }
+
+    int status = 1;
+    int flags = fcntl(out_fd, F_GETFL);
+    if (flags >= 0 && !(flags & O_APPEND)) {
+        if (S_ISREG(in_st.st_mode) && S_ISREG(out_st.st_mode)) {
+            status = kernel_copy(COPY_RANGE, in_fd, out_fd);
+        }
+        if (status > 0 && S_ISREG(in_st.st_mode)) {
+            status = kernel_copy(SEND_FILE, in_fd, out_fd);
+        }
+        if (status > 0 &&
+            (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode))) {
+            status = kernel_copy(SPLICE, in_fd, out_fd);
+        }
+    }
+    if (status <= 0) {
+        return status;
+    }
+
+    char *buffer = malloc(COPY_BUFFER_SIZE);
+    if (!buffer) {
+        return -1;
+    }
+    status = copy_buffered(in_fd, &out_fd, 1, buffer);
+    int error = errno;
+    free(buffer);
+    errno = error;
+    return status;
+}
+
+/*
+ * copies a whole regular file into a new, empty one
+ * FICLONE(2) shares every block with the source on filesystems with
+ * reflinks, so nothing is copied until one of them is written; otherwise
+ * copy_fd moves the data
+ *
+ * in_fd - file to copy, at offset 0
+ * out_fd - empty file to copy it to
+ * returns 0 on success, -1 on error with errno set
+ */
+int copy_file(int in_fd, int out_fd) {
+    if (ioctl(out_fd, FICLONE, in_fd) == 0) {
+        return 0;
+    }
+    // EOPNOTSUPP, EXDEV, EINVAL and the like only mean no reflink here
+    if (errno == EBADF || errno == EIO || errno == ENOSPC) {
+        return -1;
+    }
+    return copy_fd(in_fd, out_fd);
+}
+
+// a directory whose entries are still to be copied; its copy exists
+// pending counts the scan of the directory itself plus every subdirectory
+// that is not copied yet; whoever drops it to 0 gives the copy its mode
+// opening counts the scan plus every subdirectory that has not opened
+// itself from the fds yet; whoever drops it to 0 closes them, so a deep
+// tree only keeps the directories being scanned open
+struct tree_task {
+    struct tree_task *parent;  // NULL for the top directory
+    int source_fd;             // fds of the directory and its copy, -1
+    int dest_fd;               // until the task runs
+    long pending;
+    long opening;
+    int chmod;                 // 1 if the copy is given mode once filled
+    int keep;                  // 1 if it or a directory above it is, so
+                               // an fd of the copy is passed up
+    mode_t mode;
+    dev_t dev;                 // identity of the copy, to check that ".."
+    ino_t ino;                 // of a copied subdirectory leads back to it
+    char name[];               // name in parent, empty for the top one
+};
+
+// state shared by the tasks of one copy_tree call
+struct tree_copy {
+    const char *source;  // paths of the top directories, for errors
+    const char *dest;
+    mode_t umask;        // umask of the shell, which modes are given under
+    int status;          // -1 once anything was not copied
+    char *buffers;       // DIRENT_BUFFER_SIZE bytes per worker for getdents64
+    const volatile sig_atomic_t *cancel;  // nonzero once asked to stop
+};
+
+/*
+ * says if the caller asked the copy to stop
+ * a stopped task copies nothing more but still gives the directories
+ * already created their modes
+ */
+static int cancelled(const struct tree_copy *copy) {
+    return copy->cancel && __atomic_load_n(copy->cancel, __ATOMIC_RELAXED);
+}
+
+/*
+ * allocates a task for a directory
+ *
+ * parent - task of the directory it is in, NULL for the top directory
+ * name - name of the directory in parent
+ * returns task, NULL on allocation failure
+ */
+static struct tree_task *new_tree_task(struct tree_task *parent,
+                                       const char *name) {
+    size_t length = strlen(name);
+    struct tree_task *task = malloc(sizeof(struct tree_task) + length + 1);
+    if (!task) {
+        return NULL;
+    }
+    task->parent = parent;
+    task->source_fd = -1;
+    task->dest_fd = -1;
+    task->pending = 1;
+    task->opening = 1;
+    task->chmod = 0;
+    task->keep = 0;
+    task->mode = 0;
+    task->dev = 0;
+    task->ino = 0;
+    memcpy(task->name, name, length + 1);
+    return task;
+}
+
+/*
+ * prints the path of a directory in the source or the copy, joined from
+ * the names of the directories above it
+ */
+static void print_tree_path(const struct tree_copy *copy,
+                            const struct tree_task *task, int dest) {
+    if (!task->parent) {
+        fputs(dest ? copy->dest : copy->source, stderr);
+        return;
+    }
+    print_tree_path(copy, task->parent, dest);
+    fprintf(stderr, "/%s", task->name);
+}
+
+/*
+ * prints why a file could not be copied and marks the copy as failed
+ *
+ * copy - state of the call
+ * task - directory the file is in, or the file itself if name is NULL
+ * dest - 1 if the error is about the copy, 0 if about the source
+ * name - name of the file, or NULL
+ * error - errno value
+ */
+static void report_copy(struct tree_copy *copy, const struct tree_task *task,
+                        int dest, const char *name, int error) {
+    char message[128];
+    flockfile(stderr);
+    fputs("cp: ", stderr);
+    print_tree_path(copy, task, dest);
+    if (name) {
+        fprintf(stderr, "/%s", name);
+    }
+    fprintf(stderr, ": %s\n", strerror_r(error, message, sizeof(message)));
+    funlockfile(stderr);
+    __atomic_store_n(&copy->status, -1, __ATOMIC_RELAXED);
+}
+
+/*
+ * drops one reference to a directory's fds, closing them after the last
+ */
+static void release_fds(struct tree_task *task) {
+    if (__atomic_sub_fetch(&task->opening, 1, __ATOMIC_ACQ_REL) == 0) {
+        close(task->source_fd);
+        close(task->dest_fd);
+    }
+}
+
+/*
+ * opens the copy of a task's parent through ".." of an fd of the task's
+ * copy, so giving the parent its mode needs no fd of it kept open
+ * the result must be the parent's copy, or the copy was moved while it
+ * was being filled
+ *
+ * copy - state of the call
+ * task - task whose parent's copy to open
+ * fd - fd of the task's copy
+ * returns fd of the parent's copy, -1 after printing an error
+ */
+static int open_dest_parent(struct tree_copy *copy,
+                            const struct tree_task *task, int fd) {
+    const struct tree_task *parent = task->parent;
+    int parent_fd = openat(fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (parent_fd < 0) {
+        report_copy(copy, parent, 1, NULL, errno);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(parent_fd, &st) < 0 || st.st_dev != parent->dev ||
+        st.st_ino != parent->ino) {
+        report_copy(copy, parent, 1, NULL, ESTALE);
+        close(parent_fd);
+        return -1;
+    }
+    return parent_fd;
+}
+
+/*
+ * drops one reference to a directory, and once its whole subtree is
+ * copied gives the copy its mode, which in turn drops a reference to its
+ * parent
+ * copies are created writable so they can be filled, and only directories
+ * whose mode leaves that out need it set afterwards
+ *
+ * copy - state of the call
+ * task - directory to drop a reference to
+ * fd - fd of the directory's copy, closed here, or -1 if neither it nor
+ *      a directory above it needs a mode
+ */
+static void finish_tree_task(struct tree_copy *copy, struct tree_task *task,
+                             int fd) {
+    while (1) {
+        if (__atomic_sub_fetch(&task->pending, 1, __ATOMIC_ACQ_REL) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return;
+        }
+        struct tree_task *parent = task->parent;
+        int parent_fd = -1;
+        if (parent && parent->keep && fd >= 0) {
+            parent_fd = open_dest_parent(copy, task, fd);
+        }
+        if (task->chmod && fd >= 0 && fchmod(fd, task->mode) < 0) {
+            report_copy(copy, task, 1, NULL, errno);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(task);
+        if (!parent) {
+            return;
+        }
+        task = parent;
+        fd = parent_fd;
+    }
+}
+
+/*
+ * copies one entry of a directory that is not itself a directory:
+ * regular files through copy_file and symlinks as symlinks
+ *
+ * source_fd - directory the entry is in
+ * dest_fd - copy of that directory
+ * name - name of the entry
+ * st - status of the entry, not following symlinks
+ * returns 0 on success, otherwise errno value
+ */
+static int copy_entry(int source_fd, int dest_fd, const char *name,
+                      const struct stat *st) {
+    if (S_ISLNK(st->st_mode)) {
+        char target[PATH_MAX];
+        ssize_t length = readlinkat(source_fd, name, target,
+                                    sizeof(target) - 1);
+        if (length < 0) {
+            return errno;
+        }
+        target[length] = '\0';
+        return symlinkat(target, dest_fd, name) < 0 ? errno : 0;
+    }
+    if (!S_ISREG(st->st_mode)) {
+        return EOPNOTSUPP;
+    }
+
+    int in_fd = openat(source_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (in_fd < 0) {
+        return errno;
+    }
+    int out_fd = openat(dest_fd, name,
+                        O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+                        st->st_mode & 0777);
+    int error = 0;
+    if (out_fd < 0 || copy_file(in_fd, out_fd) < 0) {
+        error = errno;
+    }
+    close(in_fd);
+    if (out_fd >= 0) {
+        close(out_fd);
+    }
+    return error;
+}
+
+/*
+ * opens a directory and its copy from the fds of their parents, and
+ * notes the identity of the copy if an fd of it is passed up
+ *
+ * returns 0 on success, -1 after printing an error
+ */
+static int open_tree_task(struct tree_copy *copy, struct tree_task *task) {
+    const struct tree_task *parent = task->parent;
+    int flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+    task->source_fd = openat(parent->source_fd, task->name, flags);
+    if (task->source_fd < 0) {
+        report_copy(copy, parent, 0, task->name, errno);
+        return -1;
+    }
+    task->dest_fd = openat(parent->dest_fd, task->name, flags);
+    struct stat st;
+    if (task->dest_fd < 0 ||
+        (task->keep && fstat(task->dest_fd, &st) < 0)) {
+        report_copy(copy, parent, 1, task->name, errno);
+        close(task->source_fd);
+        if (task->dest_fd >= 0) {
+            close(task->dest_fd);
+        }
+        return -1;
+    }
+    if (task->keep) {
+        task->dev = st.st_dev;
+        task->ino = st.st_ino;
+    }
+    return 0;
+}
+
+/*
+ * copies the entries of one directory: files are copied right away and
+ * each subdirectory is created and becomes a task on this thread's deque
+ *
+ * pool - pool running the task
+ * worker - index of the thread running it
+ * arg - struct tree_task of the directory
+ * copy_arg - struct tree_copy of the call
+ */
+static void run_tree_task(pool_t *pool, size_t worker, void *arg,
+                          void *copy_arg) {
+    struct tree_task *task = arg;
+    struct tree_copy *copy = copy_arg;
+    char *buffer = copy->buffers + worker * DIRENT_BUFFER_SIZE;
+    struct tree_task *parent = task->parent;
+    if (parent) {
+        if (cancelled(copy) || open_tree_task(copy, task) < 0) {
+            // the parent still gets its mode, so it gets an fd of its
+            // copy just as a copied subdirectory would pass up
+            int fd = -1;
+            if (parent->keep &&
+                (fd = fcntl(parent->dest_fd, F_DUPFD_CLOEXEC, 0)) < 0) {
+                report_copy(copy, parent, 1, NULL, errno);
+            }
+            free(task);
+            release_fds(parent);
+            finish_tree_task(copy, parent, fd);
+            return;
+        }
+        release_fds(parent);
+    }
+
+    while (!cancelled(copy)) {
+        long size = syscall(SYS_getdents64, task->source_fd, buffer,
+                            DIRENT_BUFFER_SIZE);
+        if (size <= 0) {
+            if (size < 0) {
+                report_copy(copy, task, 0, NULL, errno);
+            }
+            break;
+        }
+        for (long offset = 0; offset < size && !cancelled(copy);) {
+            struct dirent_record *record =
+                (struct dirent_record *)(void *)(buffer + offset);
+            offset += record->d_reclen;
+            const char *name = record->d_name;
+            if (name[0] == '.' &&
+                (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            struct stat st;
+            if (fstatat(task->source_fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+                report_copy(copy, task, 0, name, errno);
+                continue;
+            }
+            if (!S_ISDIR(st.st_mode)) {
+                int error = copy_entry(task->source_fd, task->dest_fd, name,
+                                       &st);
+                if (error) {
+                    report_copy(copy, task, 0, name, error);
+                }
+                continue;
+            }
+
+            // an existing directory is filled but keeps its mode
+            mode_t mode = st.st_mode & 07777;
+            int created = mkdirat(task->dest_fd, name, mode | S_IRWXU) == 0;
+            if (!created && errno != EEXIST) {
+                report_copy(copy, task, 1, name, errno);
+                continue;
+            }
+            struct tree_task *child = new_tree_task(task, name);
+            if (child) {
+                child->chmod = created && (mode & S_IRWXU) != S_IRWXU;
+                child->keep = child->chmod || task->keep;
+                child->mode = mode & ~copy->umask;
+            }
+            __atomic_add_fetch(&task->pending, 1, __ATOMIC_ACQ_REL);
+            __atomic_add_fetch(&task->opening, 1, __ATOMIC_ACQ_REL);
+            if (!child || pool_push(pool, worker, child) < 0) {
+                report_copy(copy, task, 0, name, ENOMEM);
+                free(child);
+                __atomic_sub_fetch(&task->opening, 1, __ATOMIC_ACQ_REL);
+                __atomic_sub_fetch(&task->pending, 1, __ATOMIC_ACQ_REL);
+            }
+        }
+    }
+
+    // the scan's reference may turn out to be the last one, so a copy
+    // whose fd is passed up keeps one: dest_fd itself if every
+    // subdirectory has opened already, otherwise a dup, since the last one
+    // to open closes dest_fd
+    int fd = -1;
+    if (task->keep &&
+        __atomic_load_n(&task->opening, __ATOMIC_ACQUIRE) > 1 &&
+        (fd = fcntl(task->dest_fd, F_DUPFD_CLOEXEC, 0)) < 0) {
+        report_copy(copy, task, 1, NULL, errno);
+    }
+    if (__atomic_sub_fetch(&task->opening, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        close(task->source_fd);
+        fd = task->dest_fd;
+    }
+    finish_tree_task(copy, task, fd);
+}
+
+/*
+ * copies a directory and everything under it
+ * each directory is a task on a pool of threads that steal tasks from each
+ * other, one per CPU up to TREE_MAX_THREADS; a task reads its directory
+ * with getdents64, creates each subdirectory and queues it, and copies its
+ * files with copy_file relative to fds of both directories, so no path is
+ * ever resolved twice and a tree of any depth can be copied
+ * symlinks are copied as symlinks, and other special files are left out
+ * with an error; errors are printed and the rest of the tree is still
+ * copied
+ * once cancel is set, such as from a SIGINT handler, no task copies
+ * another entry or opens another directory, and the partial copy stays
+ *
+ * source - directory to copy
+ * dest - path to copy it to, which is created unless it is a directory
+ * cancel - flag to stop early, or NULL
+ * returns 0 on success, -1 if anything could not be copied or it was
+ * stopped
+ */
+int copy_tree(const char *source, const char *dest,
+              const volatile sig_atomic_t *cancel) {
+    struct tree_copy copy = {source, dest, umask(0), 0, NULL, cancel};
+    umask(copy.umask);
+    pool_t *pool = init_pool(TREE_MAX_THREADS, run_tree_task, &copy);
+    struct tree_task *top = new_tree_task(NULL, "");
+    if (pool) {
+        copy.buffers = malloc(pool_threads(pool) * DIRENT_BUFFER_SIZE);
+    }
+    if (!pool || !top || !copy.buffers) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        cleanup_pool(pool);
+        free(top);
+        free(copy.buffers);
+        return -1;
+    }
+
+    int flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+    struct stat st;
+    top->source_fd = open(source, flags);
+    if (top->source_fd < 0 || fstat(top->source_fd, &st) < 0) {
+        report_copy(&copy, top, 0, NULL, errno);
+    } else {
+        mode_t mode = st.st_mode & 07777;
+        int created = mkdir(dest, mode | S_IRWXU) == 0;
+        top->chmod = created && (mode & S_IRWXU) != S_IRWXU;
+        top->keep = top->chmod;
+        top->mode = mode & ~copy.umask;
+        if (!created && errno != EEXIST) {
+            report_copy(&copy, top, 1, NULL, errno);
+        } else if ((top->dest_fd = open(dest, flags & ~O_NOFOLLOW)) < 0 ||
+                   fstat(top->dest_fd, &st) < 0) {
+            report_copy(&copy, top, 1, NULL, errno);
+        } else {
+            top->dev = st.st_dev;
+            top->ino = st.st_ino;
+        }
+    }
+    if (top->source_fd < 0 || top->dest_fd < 0) {
+        if (top->source_fd >= 0) {
+            close(top->source_fd);
+        }
+        free(top);
+    } else {
+        pool_run(pool, top);
+    }
+    cleanup_pool(pool);
+    free(copy.buffers);
+    return cancelled(&copy) ? -1 : copy.status;
+}
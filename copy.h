@@ -0,0 +1,68 @@
+#ifndef COPY_H_
+#define COPY_H_
+
+#include <signal.h>
+#include <stddef.h>
+
+/*
+ * copies everything read from in_fd to each of out_fds until end of file
+ * when the data can stay in the kernel it never enters user space: tee(2)
+ * duplicates pipe buffers for all outputs but one, and splice(2) moves the
+ * data into the last; O_APPEND outputs, which splice refuses, are written
+ * from a buffer instead
+ *
+ * in_fd - fd to read
+ * out_fds - fds to write, at least one
+ * count - number of out_fds
+ * returns 0 on success, -1 on error with errno set
+ */
+int tee_stream(int in_fd, const int *out_fds, size_t count);
+
+/*
+ * copies everything left in in_fd to out_fd
+ * the kernel moves the data when it can: copy_file_range(2) between
+ * regular files, sendfile(2) from a regular file to anything else, and
+ * splice(2) when either side is a pipe; whatever the kernel refuses, such
+ * as O_APPEND outputs, goes through read and write
+ *
+ * in_fd - fd to read
+ * out_fd - fd to write
+ * returns 0 on success, -1 on error with errno set
+ */
+int copy_fd(int in_fd, int out_fd);
+
+/*
+ * copies a whole regular file into a new, empty one
+ * FICLONE(2) shares every block with the source on filesystems with
+ * reflinks, so nothing is copied until one of them is written; otherwise
+ * copy_fd moves the data
+ *
+ * in_fd - file to copy, at offset 0
+ * out_fd - empty file to copy it to
+ * returns 0 on success, -1 on error with errno set
+ */
+int copy_file(int in_fd, int out_fd);
+
+/*
+ * copies a directory and everything under it
+ * each directory is a task on a pool of threads that steal tasks from each
+ * other, one per CPU up to TREE_MAX_THREADS; a task reads its directory
+ * with getdents64, creates each subdirectory and queues it, and copies its
+ * files with copy_file relative to fds of both directories, so no path is
+ * ever resolved twice and a tree of any depth can be copied
+ * symlinks are copied as symlinks, and other special files are left out
+ * with an error; errors are printed and the rest of the tree is still
+ * copied
+ * once cancel is set, such as from a SIGINT handler, no task copies
+ * another entry or opens another directory, and the partial copy stays
+ *
+ * source - directory to copy
+ * dest - path to copy it to, which is created unless it is a directory
+ * cancel - flag to stop early, or NULL
+ * returns 0 on success, -1 if anything could not be copied or it was
+ * stopped
+ */
+int copy_tree(const char *source, const char *dest,
+              const volatile sig_atomic_t *cancel);
+
+#endif  // COPY_H_
@@ -0,0 +1,18 @@
+#ifndef GETDENTS_H_
+#define GETDENTS_H_
+
+#include <stdint.h>
+
+#define DIRENT_BUFFER_SIZE 65536  // bytes asked of one getdents64
+
+// record getdents64 fills in, shared by remove.c and copy.c; glibc only
+// declares struct dirent, which is laid out for readdir
+struct dirent_record {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+#endif  // GETDENTS_H_
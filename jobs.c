@@ -4,12 +4,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+// pids and command are stored inline so a job is a single allocation
 struct job_element {
     int jid;
-    pid_t pid;
+    pid_t pid;  // process group of the job, the pid of its first process
     process_state_t state;
-    char *command;
     struct job_element *next;
+    char *command;  // points just past pids
+    size_t count;   // number of processes in the job
+    pid_t pids[];   // pid of each process, 0 once it has been reaped
 };
 typedef struct job_element job_element_t;
 
@@ -52,11 +55,6 @@ void cleanup_job_list(job_list_t *job_list) {
             }
         }
 
-        if (cur->command != NULL) {
-            free(cur->command);
-            cur->command = NULL;
-        }
-
         free(cur);
         cur = nextElement;
     }
@@ -68,25 +66,52 @@ void cleanup_job_list(job_list_t *job_list) {
     free(job_list);
 }
 
+/* checks if pid is the job's process group or one of its processes */
+static int has_pid(const job_element_t *job, pid_t pid) {
+    if (job->pid == pid) {
+        return 1;
+    }
+    for (size_t i = 0; i < job->count; i++) {
+        if (job->pids[i] == pid) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 /* adds new job to list, returns 0 on success, -1 on failure */
 int add_job(job_list_t *job_list, int jid, pid_t pid, process_state_t state,
             char *command) {
+    return add_pipeline_job(job_list, jid, pid, &pid, 1, state, command);
+}
+
+/*
+ * adds new job made of several processes in one process group, such as a
+ * pipeline, returns 0 on success, -1 on failure
+ * processes given as 0 have already been reaped
+ */
+int add_pipeline_job(job_list_t *job_list, int jid, pid_t pgid,
+                     const pid_t *pids, size_t count, process_state_t state,
+                     char *command) {
     if (job_list == NULL || (state != RUNNING && state != STOPPED) ||
-        command == NULL) {
+        command == NULL || pids == NULL) {
         return -1;
     }
 
-    job_element_t *new = (job_element_t *)malloc(sizeof(job_element_t));
+    // copy the pids and command in with the element to protect our code
+    size_t cmdlen = strlen(command);
+    job_element_t *new = (job_element_t *)malloc(
+        sizeof(job_element_t) + count * sizeof(pid_t) + cmdlen + 1);
+    if (new == NULL) {
+        return -1;
+    }
     new->jid = jid;
-    new->pid = pid;
-
-    // allocate new char*'s and copy buffers in to protect our code
+    new->pid = pgid;
     new->state = state;
-
-    size_t cmdlen = strlen(command);
-    new->command = (char *)malloc(sizeof(char) * (cmdlen + 1));
-    memcpy(new->command, command, cmdlen);
-    new->command[cmdlen] = 0;
+    new->count = count;
+    memcpy(new->pids, pids, count * sizeof(pid_t));
+    new->command = (char *)(new->pids + count);
+    memcpy(new->command, command, cmdlen + 1);
     new->next = NULL;
 
     if (job_list->head == NULL) {
@@ -126,11 +151,6 @@ int remove_job_jid(job_list_t *job_list, int jid) {
                 job_list->current = cur->next;
             }
 
-            if (cur->command != NULL) {
-                free(cur->command);
-                cur->command = NULL;
-            }
-
             free(cur);
             cur = NULL;
 
@@ -144,7 +164,7 @@ int remove_job_jid(job_list_t *job_list, int jid) {
     return -1;
 }
 
-/* removes job from list, given job's PID,
+/* removes job from list, given the PID of the job or of one of its processes,
     returns 0 on success, -1 on failure */
 int remove_job_pid(job_list_t *job_list, pid_t pid) {
     if (job_list == NULL) {
@@ -154,7 +174,7 @@ int remove_job_pid(job_list_t *job_list, pid_t pid) {
     job_element_t *prev = NULL;
     job_element_t *cur = job_list->head;
     while (cur != NULL) {
-        if (cur->pid == pid) {
+        if (has_pid(cur, pid)) {
             if (prev != NULL) {
                 prev->next = cur->next;
             }
@@ -165,10 +185,6 @@ int remove_job_pid(job_list_t *job_list, pid_t pid) {
                 job_list->current = cur->next;
             }
 
-            if (cur->command != NULL) {
-                free(cur->command);
-                cur->command = NULL;
-            }
             free(cur);
             cur = NULL;
 
@@ -201,7 +217,8 @@ int update_job_jid(job_list_t *job_list, int jid, process_state_t state) {
     return -1;
 }
 
-/* updates job's state, given job's PID, returns 0 on success, -1 on failure */
+/* updates job's state, given the PID of the job or of one of its processes,
+        returns 0 on success, -1 on failure */
 int update_job_pid(job_list_t *job_list, pid_t pid, process_state_t state) {
     if (job_list == NULL) {
         return -1;
@@ -209,7 +226,7 @@ int update_job_pid(job_list_t *job_list, pid_t pid, process_state_t state) {
 
     job_element_t *cur = job_list->head;
     while (cur != NULL) {
-        if (cur->pid == pid) {
+        if (has_pid(cur, pid)) {
             cur->state = state;
             return 0;
         }
@@ -238,7 +255,27 @@ pid_t get_job_pid(job_list_t *job_list, int jid) {
     return -1;
 }
 
-/* gets JID of job, given job's PID, returns JID on success, -1 on failure */
+/* gets state of job, given job's JID, returns 0 on success, -1 on failure */
+int get_job_state(job_list_t *job_list, int jid, process_state_t *state) {
+    if (job_list == NULL || state == NULL) {
+        return -1;
+    }
+
+    job_element_t *cur = job_list->head;
+    while (cur != NULL) {
+        if (cur->jid == jid) {
+            *state = cur->state;
+            return 0;
+        }
+
+        cur = cur->next;
+    }
+
+    return -1;
+}
+
+/* gets JID of job, given the PID of the job or of one of its processes,
+        returns JID on success, -1 on failure */
 int get_job_jid(job_list_t *job_list, pid_t pid) {
     if (job_list == NULL) {
         return -1;
@@ -246,7 +283,7 @@ int get_job_jid(job_list_t *job_list, pid_t pid) {
 
     job_element_t *cur = job_list->head;
     while (cur != NULL) {
-        if (cur->pid == pid) {
+        if (has_pid(cur, pid)) {
             return cur->jid;
         }
 
@@ -256,6 +293,39 @@ int get_job_jid(job_list_t *job_list, pid_t pid) {
     return -1;
 }
 
+/*
+ * marks a process of a job as reaped, given its PID, returns the number of
+ * processes of the job still not reaped, -1 on failure
+ */
+int reap_job_process(job_list_t *job_list, pid_t pid) {
+    if (job_list == NULL || pid <= 0) {
+        return -1;
+    }
+
+    for (job_element_t *cur = job_list->head; cur != NULL; cur = cur->next) {
+        int found = 0;
+        int remaining = 0;
+        for (size_t i = 0; i < cur->count; i++) {
+            if (cur->pids[i] == pid) {
+                cur->pids[i] = 0;
+                found = 1;
+            } else if (cur->pids[i] != 0) {
+                remaining++;
+            }
+        }
+        if (found) {
+            return remaining;
+        }
+    }
+
+    return -1;
+}
+
+/* checks if there are no jobs, returns 1 if the list is empty, 0 if not */
+int job_list_empty(job_list_t *job_list) {
+    return job_list == NULL || job_list->head == NULL;
+}
+
 /*
  * gets next PID in list
  * call this in a loop to get the PID of the next job in the list
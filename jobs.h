@@ -20,23 +20,42 @@ void cleanup_job_list(job_list_t *job_list);
 /* adds new job to list, returns 0 on success, -1 on failure */
 int add_job(job_list_t *job_list, int jid, pid_t pid, process_state_t state,
             char *command);
+/*
+ * adds new job made of several processes in one process group, such as a
+ * pipeline, returns 0 on success, -1 on failure
+ * processes given as 0 have already been reaped
+ */
+int add_pipeline_job(job_list_t *job_list, int jid, pid_t pgid,
+                     const pid_t *pids, size_t count, process_state_t state,
+                     char *command);
 
 /* removes job from list, given job's JID,
         returns 0 on success, -1 on failure */
 int remove_job_jid(job_list_t *job_list, int jid);
-/* removes job from list, given job's PID,
+/* removes job from list, given the PID of the job or of one of its processes,
         returns 0 on success, -1 on failure */
 int remove_job_pid(job_list_t *job_list, pid_t pid);
 
 /* updates job's state, given job's JID, returns 0 on success, -1 on failure */
 int update_job_jid(job_list_t *job_list, int jid, process_state_t state);
-/* updates job's state, given job's PID, returns 0 on success, -1 on failure */
+/* updates job's state, given the PID of the job or of one of its processes,
+        returns 0 on success, -1 on failure */
 int update_job_pid(job_list_t *job_list, pid_t pid, process_state_t state);
 
 /* gets PID of job, given job's JID, returns PID on success, -1 on failure */
 pid_t get_job_pid(job_list_t *job_list, int jid);
-/* gets JID of job, given job's PID, returns JID on success, -1 on failure */
+/* gets state of job, given job's JID, returns 0 on success, -1 on failure */
+int get_job_state(job_list_t *job_list, int jid, process_state_t *state);
+/* gets JID of job, given the PID of the job or of one of its processes,
+        returns JID on success, -1 on failure */
 int get_job_jid(job_list_t *job_list, pid_t pid);
+/*
+ * marks a process of a job as reaped, given its PID, returns the number of
+ * processes of the job still not reaped, -1 on failure
+ */
+int reap_job_process(job_list_t *job_list, pid_t pid);
+/* checks if there are no jobs, returns 1 if the list is empty, 0 if not */
+int job_list_empty(job_list_t *job_list);
 
 /*
  * gets next PID in list
@@ -0,0 +1,470 @@
+#include "./lex.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// longer runs of digits than this bound are words, not the fd of a
+// redirection
+#define MAX_FD 100000
+
+// bytes that end the plain run of a word: whitespace, quotes, backslash, $
+// and the first byte of every operator
+// the SSE2 scan below matches whole byte ranges, so a few bytes that are
+// ordinary in a word (other control bytes, # % =) stop it as well; those
+// are part of the word
+static const unsigned char special[256] = {
+    [' '] = 1, ['\t'] = 1, ['\n'] = 1, ['\''] = 1, ['"'] = 1, ['\\'] = 1,
+    ['$'] = 1, ['<'] = 1,  ['>'] = 1,  ['&'] = 1,  [';'] = 1,  ['|'] = 1,
+    ['('] = 1, [')'] = 1,
+};
+
+/*
+ * checks if an unquoted byte ends a word
+ *
+ * c - byte to check
+ */
+static int is_delimiter(char c) {
+    switch (c) {
+        case ' ':
+        case '\t':
+        case '\n':
+        case '<':
+        case '>':
+        case '&':
+        case ';':
+        case '(':
+        case ')':
+        case '|':
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * finds the first special byte in [p, end)
+ * classifies 16 bytes at a time when SSE2 is available, and finishes the
+ * tail one byte at a time
+ *
+ * returns pointer to the first byte that may be special, or end if none
+ */
+static char *find_special(char *p, char *end) {
+#ifdef __SSE2__
+    // bytes <= ' ' cover whitespace, '"' to ')' covers both quotes, $, &
+    // and parentheses, and ';' to '>' covers ; and both redirections
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i quote_base = _mm_set1_epi8('"');
+    const __m128i quote_span = _mm_set1_epi8(')' - '"');
+    const __m128i redirect_base = _mm_set1_epi8(';');
+    const __m128i redirect_span = _mm_set1_epi8('>' - ';');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i bar = _mm_set1_epi8('|');
+
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        __m128i hit =
+            _mm_cmpeq_epi8(_mm_max_epu8(chunk, space), space);
+        __m128i offset = _mm_sub_epi8(chunk, quote_base);
+        hit = _mm_or_si128(
+            hit, _mm_cmpeq_epi8(_mm_max_epu8(offset, quote_span), quote_span));
+        offset = _mm_sub_epi8(chunk, redirect_base);
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(
+                                    _mm_max_epu8(offset, redirect_span),
+                                    redirect_span));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(chunk, backslash));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(chunk, bar));
+
+        int mask = _mm_movemask_epi8(hit);
+        if (mask != 0) {
+            return p + __builtin_ctz((unsigned int)mask);
+        }
+        p += 16;
+    }
+#endif
+
+    while (p < end && !special[(unsigned char)*p]) {
+        p++;
+    }
+    return p;
+}
+
+/*
+ * initializes lexer over a line
+ * the line is modified in place as words are returned
+ *
+ * line - start of line
+ * length - length of line in bytes, line[length] must be writable
+ */
+void init_lexer(lexer_t *lexer, char *line, size_t length) {
+    lexer->cursor = line;
+    lexer->end = line + length;
+    lexer->saved = 0;
+    lexer->after_dup = 0;
+}
+
+/*
+ * checks if p starts the name of an expansion after a $
+ */
+static int is_expansion_start(const char *p, const char *end) {
+    return p < end && (*p == '_' || *p == '{' || *p == '?' ||
+                       (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z'));
+}
+
+/*
+ * checks if c can appear in a variable name after its first byte
+ */
+static int is_name_char(char c) {
+    return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9');
+}
+
+/*
+ * copies the expansion starting after a $ at src into dst
+ *
+ * dst - buffer to write the value to, NULL to only measure it
+ * src - pointer to the byte after the $, advanced past the name
+ * lookup - looks up the value of a name
+ * returns length of the value
+ */
+static size_t copy_expansion(char *dst, const char **src, const char *end,
+                             expand_lookup_t lookup) {
+    const char *name = *src;
+    size_t name_length;
+
+    if (*name == '{') {
+        name++;
+        const char *close = memchr(name, '}', (size_t)(end - name));
+        if (close == NULL) {
+            close = end;
+        }
+        name_length = (size_t)(close - name);
+        *src = close < end ? close + 1 : end;
+    } else if (*name == '?') {
+        name_length = 1;
+        *src = name + 1;
+    } else {
+        const char *p = name;
+        while (p < end && is_name_char(*p)) {
+            p++;
+        }
+        name_length = (size_t)(p - name);
+        *src = p;
+    }
+
+    const char *value = lookup(name, name_length);
+    if (value == NULL) {
+        return 0;
+    }
+    size_t length = strlen(value);
+    if (dst != NULL) {
+        memcpy(dst, value, length);
+    }
+    return length;
+}
+
+/*
+ * copies a word while removing quotes and escapes
+ * with a lookup, $name, ${name} and $? outside single quotes are replaced by
+ * their values; without one, $ is copied like any other byte
+ * dst may equal src when there is no lookup, since the copy never grows
+ *
+ * dst - buffer to write the word to, NULL to only measure it
+ * src - start of the quoted word, which must have matched quotes
+ * end - end of the quoted word
+ * lookup - looks up the value of a name, or NULL
+ * returns length of the copied word
+ */
+static size_t unquote(char *dst, const char *src, const char *end,
+                      expand_lookup_t lookup) {
+    size_t length = 0;
+    const char *read = src;
+
+    while (read < end) {
+        char c = *read;
+        if (c == '\\') {
+            // backslash keeps the next byte literally
+            read++;
+            if (read < end) {
+                if (dst != NULL) {
+                    dst[length] = *read;
+                }
+                length++;
+                read++;
+            }
+        } else if (c == '\'') {
+            // single quotes keep everything up to the closing quote
+            const char *close =
+                memchr(read + 1, '\'', (size_t)(end - read - 1));
+            size_t span = (size_t)(close - read - 1);
+            if (dst != NULL) {
+                memmove(dst + length, read + 1, span);
+            }
+            length += span;
+            read = close + 1;
+        } else if (c == '"') {
+            // double quotes allow backslash before \\, " and $ only
+            read++;
+            while (*read != '"') {
+                if (*read == '\\' &&
+                    (read[1] == '\\' || read[1] == '"' || read[1] == '$')) {
+                    read++;
+                } else if (*read == '$' && lookup != NULL &&
+                           is_expansion_start(read + 1, end)) {
+                    read++;
+                    length += copy_expansion(dst ? dst + length : NULL, &read,
+                                             end, lookup);
+                    continue;
+                }
+                if (dst != NULL) {
+                    dst[length] = *read;
+                }
+                length++;
+                read++;
+            }
+            read++;
+        } else if (c == '$' && lookup != NULL &&
+                   is_expansion_start(read + 1, end)) {
+            read++;
+            length += copy_expansion(dst ? dst + length : NULL, &read, end,
+                                     lookup);
+        } else {
+            if (dst != NULL) {
+                dst[length] = c;
+            }
+            length++;
+            read++;
+        }
+    }
+    return length;
+}
+
+/*
+ * reads one word starting at the lexer's cursor
+ * a first pass finds the end of the word and whether it has quotes or
+ * expansions; quotes and escapes are then removed by moving bytes left
+ * within the line, unless the word has expansions, which is kept as written
+ * so expand_word can handle quotes and expansions together
+ *
+ * token - pointer to store the word
+ * returns 0 on success, -1 on unterminated quote
+ */
+static int read_word(lexer_t *lexer, token_t *token) {
+    char *start = lexer->cursor;
+    char *end = lexer->end;
+    char *read = start;
+    int quoted = 0;
+    int expand = 0;
+
+    while (read < end) {
+        read = find_special(read, end);
+        if (read == end || is_delimiter(*read)) {
+            break;
+        }
+
+        if (*read == '\\') {
+            quoted = 1;
+            read += read + 1 < end ? 2 : 1;
+        } else if (*read == '\'') {
+            quoted = 1;
+            char *close = memchr(read + 1, '\'', (size_t)(end - read - 1));
+            if (close == NULL) {
+                fprintf(stderr, "ERROR: Unterminated single quote\n");
+                return -1;
+            }
+            read = close + 1;
+        } else if (*read == '"') {
+            quoted = 1;
+            read++;
+            while (read < end && *read != '"') {
+                if (*read == '\\' && read + 1 < end) {
+                    read++;
+                } else if (*read == '$' && is_expansion_start(read + 1, end)) {
+                    expand = 1;
+                }
+                read++;
+            }
+            if (read == end) {
+                fprintf(stderr, "ERROR: Unterminated double quote\n");
+                return -1;
+            }
+            read++;
+        } else {
+            // $ or a byte that only shares a range with the special ones
+            if (*read == '$' && is_expansion_start(read + 1, end)) {
+                expand = 1;
+            }
+            read++;
+        }
+    }
+
+    char *write = read;
+    if (quoted && !expand) {
+        write = start + unquote(start, start, read, NULL);
+    }
+
+    // terminating the word in place may overwrite the operator right after
+    // it, so keep that byte aside for the next call
+    if (write == read && read < end && *read != ' ' && *read != '\t' &&
+        *read != '\n') {
+        lexer->saved = *read;
+    }
+    *write = '\0';
+
+    token->type = TOKEN_WORD;
+    token->text = start;
+    token->length = (size_t)(write - start);
+    token->expand = expand;
+    token->fd = -1;
+    lexer->cursor = read;
+    return 0;
+}
+
+/*
+ * expands a word that next_token returned with expand set
+ * removes its quotes and escapes and replaces each $name, ${name} and $?
+ * outside single quotes with the value lookup returns, or nothing if lookup
+ * returns NULL
+ *
+ * word - null terminated word as written
+ * arena - arena to allocate the expanded word from
+ * lookup - looks up the value of a name
+ * returns expanded word, NULL on allocation failure
+ */
+char *expand_word(const char *word, arena_t *arena, expand_lookup_t lookup) {
+    const char *end = word + strlen(word);
+    size_t length = unquote(NULL, word, end, lookup);
+
+    char *expanded = arena_alloc(arena, length + 1);
+    if (expanded == NULL) {
+        return NULL;
+    }
+    unquote(expanded, word, end, lookup);
+    expanded[length] = '\0';
+    return expanded;
+}
+
+/*
+ * gets the next token from the line
+ * words point into the line itself: quotes and backslashes are removed by
+ * moving the rest of the word left, and the word is null terminated in place
+ * digits right before < or > are the fd of that redirection, not a word
+ *
+ * token - pointer to store token
+ * returns 0 on success, -1 on syntax error
+ */
+int next_token(lexer_t *lexer, token_t *token) {
+    char c;
+    if (lexer->saved != 0) {
+        c = lexer->saved;
+        lexer->saved = 0;
+    } else {
+        // a null byte here is whitespace that ended the previous word
+        while (lexer->cursor < lexer->end &&
+               (*lexer->cursor == ' ' || *lexer->cursor == '\t' ||
+                *lexer->cursor == '\n' || *lexer->cursor == '\0')) {
+            lexer->cursor++;
+        }
+        if (lexer->cursor == lexer->end) {
+            token->type = TOKEN_END;
+            token->text = NULL;
+            token->length = 0;
+            token->expand = 0;
+            token->fd = -1;
+            return 0;
+        }
+        c = *lexer->cursor;
+    }
+
+    token->text = NULL;
+    token->length = 0;
+    token->expand = 0;
+    token->fd = -1;
+    int after_dup = lexer->after_dup;
+    lexer->after_dup = 0;
+    if (c >= '0' && c <= '9' && !after_dup) {
+        // digits right before < or > name the fd to redirect, as in 2>file
+        char *p = lexer->cursor;
+        int fd = 0;
+        while (p < lexer->end && *p >= '0' && *p <= '9' && fd < MAX_FD) {
+            fd = fd * 10 + (*p - '0');
+            p++;
+        }
+        if (p < lexer->end && (*p == '<' || *p == '>')) {
+            token->fd = fd;
+            lexer->cursor = p;
+            c = *p;
+        }
+    }
+
+    char next = lexer->cursor + 1 < lexer->end ? lexer->cursor[1] : '\0';
+    switch (c) {
+        case '<':
+            if (next == '>') {
+                token->type = TOKEN_READ_WRITE;
+                lexer->cursor += 2;
+            } else if (next == '&') {
+                token->type = TOKEN_DUP_INPUT;
+                lexer->cursor += 2;
+                lexer->after_dup = 1;
+            } else {
+                token->type = TOKEN_INPUT;
+                lexer->cursor++;
+            }
+            return 0;
+        case '>':
+            if (next == '>') {
+                token->type = TOKEN_APPEND;
+                lexer->cursor += 2;
+            } else if (next == '&') {
+                token->type = TOKEN_DUP_OUTPUT;
+                lexer->cursor += 2;
+                lexer->after_dup = 1;
+            } else {
+                token->type = TOKEN_OUTPUT;
+                lexer->cursor++;
+            }
+            return 0;
+        case '&':
+            if (next == '&') {
+                token->type = TOKEN_AND;
+                lexer->cursor += 2;
+            } else if (next == '>') {
+                token->type = TOKEN_OUTPUT_ALL;
+                lexer->cursor += 2;
+            } else {
+                token->type = TOKEN_BACKGROUND;
+                lexer->cursor++;
+            }
+            return 0;
+        case ';':
+            if (next == ';') {
+                token->type = TOKEN_DOUBLE_SEMICOLON;
+                lexer->cursor += 2;
+            } else {
+                token->type = TOKEN_SEMICOLON;
+                lexer->cursor++;
+            }
+            return 0;
+        case '(':
+            token->type = TOKEN_OPEN_PAREN;
+            lexer->cursor++;
+            return 0;
+        case ')':
+            token->type = TOKEN_CLOSE_PAREN;
+            lexer->cursor++;
+            return 0;
+        case '|':
+            if (next == '|') {
+                token->type = TOKEN_OR;
+                lexer->cursor += 2;
+            } else {
+                token->type = TOKEN_PIPE;
+                lexer->cursor++;
+            }
+            return 0;
+        default:
+            return read_word(lexer, token);
+    }
+}
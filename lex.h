@@ -0,0 +1,86 @@
+#ifndef LEX_H_
+#define LEX_H_
+
+#include <stddef.h>
+#include "./arena.h"
+
+typedef enum {
+    TOKEN_WORD,              // word, with quotes and escapes removed
+    TOKEN_INPUT,             // <
+    TOKEN_OUTPUT,            // >
+    TOKEN_APPEND,            // >>
+    TOKEN_READ_WRITE,        // <>
+    TOKEN_DUP_INPUT,         // <&
+    TOKEN_DUP_OUTPUT,        // >&
+    TOKEN_OUTPUT_ALL,        // &>
+    TOKEN_BACKGROUND,        // &
+    TOKEN_SEMICOLON,         // ;
+    TOKEN_AND,               // &&
+    TOKEN_OR,                // ||
+    TOKEN_PIPE,              // |
+    TOKEN_DOUBLE_SEMICOLON,  // ;;
+    TOKEN_OPEN_PAREN,        // (
+    TOKEN_CLOSE_PAREN,       // )
+    TOKEN_NEWLINE,           // end of a line inside a compound command
+    TOKEN_END                // end of line
+} token_type_t;
+
+typedef struct token {
+    token_type_t type;
+    char *text;     // null terminated word, NULL for operators
+    size_t length;  // length of text
+    int expand;     // 1 if text is kept as written because it has a $
+    int fd;         // digits written right before a redirection, -1 if none
+} token_t;
+
+/* looks up the value of a name for expand_word, NULL if it is unset */
+typedef const char *(*expand_lookup_t)(const char *name, size_t length);
+
+// cursor is the next unread byte of the line
+// saved holds an operator byte that was overwritten to terminate the word
+// before it, 0 if none
+// after_dup is 1 right after <& or >&, whose fd number is a word even when
+// another redirection follows it, as in 2>&1>file
+typedef struct lexer {
+    char *cursor;
+    char *end;
+    char saved;
+    int after_dup;
+} lexer_t;
+
+/*
+ * initializes lexer over a line
+ * the line is modified in place as words are returned
+ *
+ * line - start of line
+ * length - length of line in bytes, line[length] must be writable
+ */
+void init_lexer(lexer_t *lexer, char *line, size_t length);
+
+/*
+ * gets the next token from the line
+ * words point into the line itself: quotes and backslashes are removed by
+ * moving the rest of the word left, and the word is null terminated in place
+ * words with $name, ${name} or $? outside single quotes are left as written
+ * and have expand set
+ * digits right before < or > are the fd of that redirection, not a word
+ *
+ * token - pointer to store token
+ * returns 0 on success, -1 on syntax error
+ */
+int next_token(lexer_t *lexer, token_t *token);
+
+/*
+ * expands a word that next_token returned with expand set
+ * removes its quotes and escapes and replaces each $name, ${name} and $?
+ * outside single quotes with the value lookup returns, or nothing if lookup
+ * returns NULL
+ *
+ * word - null terminated word as written
+ * arena - arena to allocate the expanded word from
+ * lookup - looks up the value of a name
+ * returns expanded word, NULL on allocation failure
+ */
+char *expand_word(const char *word, arena_t *arena, expand_lookup_t lookup);
+
+#endif  // LEX_H_
@@ -0,0 +1,489 @@
+#include "./path.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// slots in a new table, always a power of two
+#define PATH_CACHE_SLOTS 64
+// search path used when PATH is unset
+#define DEFAULT_PATH "/bin:/usr/bin"
+// changes to PATH directories that can change what a name resolves to
+#define WATCH_EVENTS                                                    \
+    (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | \
+     IN_DELETE_SELF | IN_MOVE_SELF)
+
+// name and path are stored together in one allocation: "name\0path\0"
+// a negative entry remembers a name that is in no PATH directory
+struct path_entry {
+    uint64_t hash;
+    char *name;  // NULL if the slot is empty
+    char *path;  // NULL for a negative entry
+    unsigned long hits;
+    int recheck;  // 1 if a PATH directory that could gain the name is not
+                  // watched, so every lookup searches PATH again
+};
+typedef struct path_entry path_entry_t;
+
+// open-addressing table with linear probing, grown at 3/4 full
+// PATH directories are watched with inotify so entries are dropped when
+// their name is added to or removed from one; the fd raises SIGIO, so a
+// lookup only reads events after something changed
+struct path_cache {
+    path_entry_t *slots;
+    size_t capacity;
+    size_t count;
+    unsigned long hits;
+    unsigned long misses;
+    int inotify_fd;  // -1 if PATH is not watched
+    int watching;    // 1 once watches have been added
+    size_t watched;   // leading PATH directories that have a watch
+    int watched_all;  // 1 if every PATH directory has a watch
+    int async;       // 1 if the fd raises SIGIO when events arrive
+};
+
+// set by SIGIO when the inotify fd has events to read
+static volatile sig_atomic_t events_pending = 0;
+
+/*
+ * SIGIO handler, marks inotify events as waiting to be read
+ */
+static void note_events(int signal) {
+    (void)signal;
+    events_pending = 1;
+}
+
+/*
+ * hashes a command name with FNV-1a
+ */
+static uint64_t hash_name(const char *name) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* initializes an empty command cache, returns pointer or NULL on failure */
+path_cache_t *init_path_cache(void) {
+    path_cache_t *cache = (path_cache_t *)malloc(sizeof(path_cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->slots = (path_entry_t *)calloc(PATH_CACHE_SLOTS,
+                                          sizeof(path_entry_t));
+    if (cache->slots == NULL) {
+        free(cache);
+        return NULL;
+    }
+    cache->capacity = PATH_CACHE_SLOTS;
+    cache->count = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->inotify_fd = -1;
+    cache->watching = 0;
+    cache->watched = 0;
+    cache->watched_all = 0;
+    cache->async = 0;
+    return cache;
+}
+
+/*
+ * cleans up command cache
+ * Note: this function will free the cache pointer
+ * DO NOT use the pointer or any path it returned afterwards
+ */
+void cleanup_path_cache(path_cache_t *cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    clear_path_cache(cache);
+    if (cache->inotify_fd >= 0) {
+        close(cache->inotify_fd);
+    }
+    free(cache->slots);
+    free(cache);
+}
+
+/*
+ * finds the slot of a name, or the empty slot where it would go
+ */
+static size_t probe(path_cache_t *cache, const char *name, uint64_t hash) {
+    size_t mask = cache->capacity - 1;
+    size_t i = (size_t)hash & mask;
+    while (cache->slots[i].name != NULL) {
+        if (cache->slots[i].hash == hash &&
+            strcmp(cache->slots[i].name, name) == 0) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/*
+ * removes the entry in a slot
+ * later entries of the same probe run are shifted back into the gap, so
+ * lookups never need tombstones
+ *
+ * i - index of a full slot
+ */
+static void remove_slot(path_cache_t *cache, size_t i) {
+    size_t mask = cache->capacity - 1;
+    free(cache->slots[i].name);
+    cache->count--;
+
+    size_t j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        if (cache->slots[j].name == NULL) {
+            break;
+        }
+
+        // the entry at j can fill the gap unless its home slot lies
+        // cyclically after the gap and at or before j
+        size_t home = (size_t)cache->slots[j].hash & mask;
+        int stays = (i <= j) ? (i < home && home <= j)
+                             : (i < home || home <= j);
+        if (!stays) {
+            cache->slots[i] = cache->slots[j];
+            i = j;
+        }
+    }
+    cache->slots[i].name = NULL;
+}
+
+/*
+ * doubles the table and reinserts every entry
+ *
+ * returns 0 on success, -1 on allocation failure
+ */
+static int grow_table(path_cache_t *cache) {
+    path_entry_t *old = cache->slots;
+    size_t old_capacity = cache->capacity;
+
+    path_entry_t *slots =
+        (path_entry_t *)calloc(2 * old_capacity, sizeof(path_entry_t));
+    if (slots == NULL) {
+        return -1;
+    }
+    cache->slots = slots;
+    cache->capacity = 2 * old_capacity;
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].name != NULL) {
+            slots[probe(cache, old[i].name, old[i].hash)] = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+/*
+ * watches every PATH directory for entries being added or removed
+ * a directory that cannot be watched, such as one that does not exist
+ * yet, could gain a command unnoticed, so watched counts the leading
+ * directories that are watched and watched_all says if every one is
+ * without inotify the cache still works but keeps no negative entries,
+ * like a plain hash table of paths
+ */
+static void watch_path(path_cache_t *cache, const char *dirs) {
+    cache->watching = 1;
+    cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (cache->inotify_fd < 0) {
+        return;
+    }
+
+    char dir[PATH_MAX];
+    int gap = 0;  // 1 once a directory could not be watched
+    while (1) {
+        const char *colon = strchr(dirs, ':');
+        size_t length = colon ? (size_t)(colon - dirs) : strlen(dirs);
+        if (length == 0) {
+            memcpy(dir, ".", 2);
+        } else if (length < sizeof(dir)) {
+            memcpy(dir, dirs, length);
+            dir[length] = '\0';
+        }
+        if (length < sizeof(dir) &&
+            inotify_add_watch(cache->inotify_fd, dir,
+                              WATCH_EVENTS | IN_ONLYDIR) >= 0) {
+            if (!gap) {
+                cache->watched++;
+            }
+        } else {
+            gap = 1;
+        }
+
+        if (colon == NULL) {
+            break;
+        }
+        dirs = colon + 1;
+    }
+    cache->watched_all = !gap;
+
+    // have the fd raise SIGIO so lookups can skip reading it when nothing
+    // changed; if that fails, every lookup reads it instead
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = note_events;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    int flags = fcntl(cache->inotify_fd, F_GETFL);
+    if (sigaction(SIGIO, &action, NULL) == 0 && flags >= 0 &&
+        fcntl(cache->inotify_fd, F_SETOWN, getpid()) == 0 &&
+        fcntl(cache->inotify_fd, F_SETFL, flags | O_ASYNC) == 0) {
+        cache->async = 1;
+    }
+}
+
+/*
+ * drops the watches of PATH, so the next miss watches it again
+ * used when PATH changes or a watch is lost, since a PATH directory that
+ * is removed and created again would otherwise never be watched and
+ * negative entries would be trusted for it
+ */
+static void unwatch_path(path_cache_t *cache) {
+    if (cache->inotify_fd >= 0) {
+        close(cache->inotify_fd);
+    }
+    cache->inotify_fd = -1;
+    cache->watching = 0;
+    cache->watched = 0;
+    cache->watched_all = 0;
+    cache->async = 0;
+}
+
+/*
+ * reads pending inotify events and drops the entries they affect
+ * an entry is dropped whenever its name changes in any PATH directory,
+ * since that can change which directory it resolves to; events that lose
+ * track of a directory clear the whole cache, watches included
+ */
+static void read_events(path_cache_t *cache) {
+    if (cache->inotify_fd < 0 || (cache->async && !events_pending)) {
+        return;
+    }
+    events_pending = 0;
+
+    char buffer[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (1) {
+        ssize_t length = read(cache->inotify_fd, buffer, sizeof(buffer));
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            return;
+        }
+
+        for (char *p = buffer; p < buffer + length;) {
+            struct inotify_event *event = (struct inotify_event *)(void *)p;
+            if (event->mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF |
+                               IN_MOVE_SELF)) {
+                clear_path_cache(cache);
+                return;
+            } else if (event->len > 0) {
+                size_t i = probe(cache, event->name, hash_name(event->name));
+                if (cache->slots[i].name != NULL) {
+                    remove_slot(cache, i);
+                }
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+/*
+ * searches each PATH directory for an executable regular file
+ * an empty PATH element is the current directory
+ *
+ * name - command name
+ * dirs - colon separated list of directories
+ * path - buffer of PATH_MAX bytes to store the full path
+ * returns index of the directory it was found in, -1 if not found
+ */
+static long search_path(const char *name, const char *dirs, char *path) {
+    size_t name_length = strlen(name);
+    long index = 0;
+
+    while (1) {
+        const char *colon = strchr(dirs, ':');
+        size_t dir_length = colon ? (size_t)(colon - dirs) : strlen(dirs);
+
+        if (dir_length + name_length + 2 <= PATH_MAX) {
+            size_t length = 0;
+            if (dir_length > 0) {
+                memcpy(path, dirs, dir_length);
+                length = dir_length;
+                path[length++] = '/';
+            }
+            memcpy(path + length, name, name_length + 1);
+
+            struct stat st;
+            if (stat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+                access(path, X_OK) == 0) {
+                return index;
+            }
+        }
+
+        if (colon == NULL) {
+            return -1;
+        }
+        dirs = colon + 1;
+        index++;
+    }
+}
+
+/*
+ * finds the full path of a command name through the cache
+ * a hit costs one table probe; a miss searches each PATH directory and
+ * adds the result to the cache, including a negative entry if the name
+ * was not found
+ * an entry that a PATH directory without a watch could change is checked
+ * by searching again on every hit, and replaced if the result changed
+ *
+ * name - command name without a slash
+ * returns full path, valid until the cache is cleared, NULL if not found
+ */
+const char *find_command(path_cache_t *cache, const char *name) {
+    if (cache == NULL || name == NULL) {
+        return NULL;
+    }
+
+    read_events(cache);
+    uint64_t hash = hash_name(name);
+    size_t i = probe(cache, name, hash);
+    if (cache->slots[i].name != NULL && !cache->slots[i].recheck) {
+        cache->slots[i].hits++;
+        cache->hits++;
+        return cache->slots[i].path;
+    }
+    cache->misses++;
+
+    const char *dirs = getenv("PATH");
+    if (dirs == NULL) {
+        dirs = DEFAULT_PATH;
+    }
+    if (!cache->watching) {
+        watch_path(cache, dirs);
+    }
+
+    // a missing name is only remembered while inotify can say when it
+    // appears; with inotify, any directory up to where a name was found
+    // can gain it, so unless all of them are watched the entry is checked
+    // on every lookup
+    char path[PATH_MAX];
+    long index = search_path(name, dirs, path);
+    int found = index >= 0;
+    if (!found && cache->inotify_fd < 0) {
+        return NULL;
+    }
+    int recheck = cache->inotify_fd >= 0 &&
+                  (found ? (size_t)index >= cache->watched
+                         : !cache->watched_all);
+
+    path_entry_t *entry = &cache->slots[i];
+    if (entry->name != NULL) {
+        // a checked entry that still holds keeps its path valid
+        if (found ? entry->path && strcmp(entry->path, path) == 0
+                  : !entry->path) {
+            entry->hits++;
+            entry->recheck = recheck;
+            return entry->path;
+        }
+        remove_slot(cache, i);
+        i = probe(cache, name, hash);
+    }
+
+    // keep the load at most 3/4 so probe sequences stay short
+    if (4 * (cache->count + 1) > 3 * cache->capacity) {
+        if (grow_table(cache) < 0) {
+            return NULL;
+        }
+        i = probe(cache, name, hash);
+    }
+
+    size_t name_size = strlen(name) + 1;
+    size_t path_size = found ? strlen(path) + 1 : 0;
+    char *block = (char *)malloc(name_size + path_size);
+    if (block == NULL) {
+        return NULL;
+    }
+    memcpy(block, name, name_size);
+    memcpy(block + name_size, path, path_size);
+
+    entry = &cache->slots[i];
+    entry->hash = hash;
+    entry->name = block;
+    entry->path = found ? block + name_size : NULL;
+    entry->hits = 0;
+    entry->recheck = recheck;
+    cache->count++;
+    return entry->path;
+}
+
+/*
+ * removes every entry from the cache, hit and miss counts are kept
+ * the watches are dropped too, so the next miss watches the current PATH
+ */
+void clear_path_cache(path_cache_t *cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < cache->capacity; i++) {
+        free(cache->slots[i].name);
+        cache->slots[i].name = NULL;
+    }
+    cache->count = 0;
+    unwatch_path(cache);
+}
+
+/* hash builtin output, prints each entry with its hits and the hit rate */
+void print_path_cache(path_cache_t *cache) {
+    unsigned long hits = 0;
+    unsigned long misses = 0;
+    get_path_cache_stats(cache, &hits, &misses);
+
+    if (cache != NULL) {
+        read_events(cache);
+    }
+    if (cache != NULL && cache->count > 0) {
+        printf("hits\tcommand\n");
+        for (size_t i = 0; i < cache->capacity; i++) {
+            path_entry_t *entry = &cache->slots[i];
+            if (entry->name == NULL) {
+                continue;
+            }
+            if (entry->path != NULL) {
+                printf("%4lu\t%s\n", entry->hits, entry->path);
+            } else {
+                printf("%4lu\t%s (not found)\n", entry->hits, entry->name);
+            }
+        }
+    } else {
+        printf("hash: hash table empty\n");
+    }
+
+    unsigned long lookups = hits + misses;
+    printf("lookups: %lu hits, %lu misses (%.1f%% hit rate)\n", hits, misses,
+           lookups ? 100.0 * (double)hits / (double)lookups : 0.0);
+}
+
+/* gets number of lookups that were hits and misses */
+void get_path_cache_stats(path_cache_t *cache, unsigned long *hits,
+                          unsigned long *misses) {
+    *hits = cache ? cache->hits : 0;
+    *misses = cache ? cache->misses : 0;
+}
@@ -0,0 +1,44 @@
+#ifndef PATH_H_
+#define PATH_H_
+
+#include <stddef.h>
+
+typedef struct path_cache path_cache_t;
+
+/* initializes an empty command cache, returns pointer or NULL on failure */
+path_cache_t *init_path_cache(void);
+/*
+ * cleans up command cache
+ * Note: this function will free the cache pointer
+ * DO NOT use the pointer or any path it returned afterwards
+ */
+void cleanup_path_cache(path_cache_t *cache);
+
+/*
+ * finds the full path of a command name through the cache
+ * a hit costs one table probe; a miss searches each PATH directory and
+ * adds the result to the cache, including a negative entry if the name
+ * was not found
+ * PATH directories are watched with inotify, and entries whose name is
+ * added to or removed from one of them are dropped; an entry that a
+ * directory without a watch could change is checked on every lookup
+ *
+ * name - command name without a slash
+ * returns full path, valid until the cache is cleared, NULL if not found
+ */
+const char *find_command(path_cache_t *cache, const char *name);
+
+/*
+ * removes every entry from the cache, hit and miss counts are kept
+ * the watches are dropped too, so the next miss watches the current PATH
+ */
+void clear_path_cache(path_cache_t *cache);
+
+/* hash builtin output, prints each entry with its hits and the hit rate */
+void print_path_cache(path_cache_t *cache);
+
+/* gets number of lookups that were hits and misses */
+void get_path_cache_stats(path_cache_t *cache, unsigned long *hits,
+                          unsigned long *misses);
+
+#endif  // PATH_H_
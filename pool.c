@@ -0,0 +1,252 @@
+#include "./pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define INITIAL_DEQUE 64  // tasks a deque holds before it grows
+
+// tasks of one thread; the owner pushes and pops at tail, so it works
+// depth first, and other threads steal the oldest task from head
+struct deque {
+    pthread_mutex_t lock;
+    void **tasks;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+};
+
+// argument of one thread
+struct worker {
+    pool_t *pool;
+    size_t index;  // deque the thread owns
+};
+
+struct pool {
+    struct deque *deques;     // one per thread
+    struct worker *workers;   // one per thread
+    pthread_t *threads;       // one per thread, the first is unused
+    size_t count;             // number of threads
+    long queued;              // tasks in all deques
+    long outstanding;         // tasks queued or running
+    pthread_mutex_t lock;     // guards waiting on wake
+    pthread_cond_t wake;      // signalled when a task is queued or the
+                              // last one finishes
+    pool_run_t run;
+    void *arg;
+};
+
+/*
+ * initializes a pool of work-stealing threads, one per CPU up to
+ * max_threads
+ * no thread starts until pool_run has run its first task and found more
+ * queued
+ *
+ * max_threads - most threads the pool uses, counting the caller's
+ * run - function that runs a task
+ * arg - passed to run
+ * returns pointer, NULL on failure
+ */
+pool_t *init_pool(size_t max_threads, pool_run_t run, void *arg) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t count = cpus < 1 ? 1 : (size_t)cpus;
+    if (count > max_threads) {
+        count = max_threads ? max_threads : 1;
+    }
+
+    pool_t *pool = malloc(sizeof(pool_t));
+    if (!pool) {
+        return NULL;
+    }
+    pool->deques = calloc(count, sizeof(struct deque));
+    pool->workers = calloc(count, sizeof(struct worker));
+    pool->threads = calloc(count, sizeof(pthread_t));
+    if (!pool->deques || !pool->workers || !pool->threads) {
+        free(pool->deques);
+        free(pool->workers);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    pool->count = count;
+    pool->queued = 0;
+    pool->outstanding = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pool->run = run;
+    pool->arg = arg;
+    for (size_t i = 0; i < count; i++) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+    }
+    return pool;
+}
+
+/*
+ * cleans up a pool after pool_run returned
+ * Note: this function will free the pool pointer
+ */
+void cleanup_pool(pool_t *pool) {
+    if (!pool) {
+        return;
+    }
+    for (size_t i = 0; i < pool->count; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].tasks);
+    }
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->deques);
+    free(pool->workers);
+    free(pool->threads);
+    free(pool);
+}
+
+/*
+ * gets the number of threads a pool can run tasks on, so callers can
+ * keep one scratch buffer per worker index
+ */
+size_t pool_threads(const pool_t *pool) {
+    return pool->count;
+}
+
+/*
+ * queues a task on a worker's deque and wakes a thread to run it
+ * the worker runs its newest task next, so a tree is walked depth first,
+ * and idle threads steal the oldest task of another worker
+ *
+ * pool - pool to queue on
+ * worker - index of the thread queueing it
+ * task - task to queue
+ * returns 0 on success, -1 on allocation failure
+ */
+int pool_push(pool_t *pool, size_t worker, void *task) {
+    // counted first, so a thread that takes it at once cannot count it
+    // below zero
+    __atomic_add_fetch(&pool->outstanding, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+
+    struct deque *deque = &pool->deques[worker];
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail == deque->capacity) {
+        // move the live tasks down before growing
+        size_t live = deque->tail - deque->head;
+        memmove(deque->tasks, deque->tasks + deque->head,
+                live * sizeof(void *));
+        deque->head = 0;
+        deque->tail = live;
+        if (live * 2 >= deque->capacity) {
+            size_t capacity = deque->capacity ? deque->capacity * 2
+                                              : INITIAL_DEQUE;
+            void **tasks = realloc(deque->tasks, capacity * sizeof(void *));
+            if (!tasks) {
+                pthread_mutex_unlock(&deque->lock);
+                __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+                __atomic_sub_fetch(&pool->outstanding, 1, __ATOMIC_SEQ_CST);
+                return -1;
+            }
+            deque->tasks = tasks;
+            deque->capacity = capacity;
+        }
+    }
+    deque->tasks[deque->tail++] = task;
+    pthread_mutex_unlock(&deque->lock);
+
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/*
+ * takes the newest task of a thread's own deque, or else steals the
+ * oldest task of another thread's
+ *
+ * returns task, NULL if every deque is empty
+ */
+static void *take_task(pool_t *pool, size_t index) {
+    void *task = NULL;
+    for (size_t i = 0; i < pool->count && !task; i++) {
+        struct deque *deque = &pool->deques[(index + i) % pool->count];
+        pthread_mutex_lock(&deque->lock);
+        if (deque->head < deque->tail) {
+            task = i == 0 ? deque->tasks[--deque->tail]
+                          : deque->tasks[deque->head++];
+        }
+        pthread_mutex_unlock(&deque->lock);
+    }
+    if (task) {
+        __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    }
+    return task;
+}
+
+/*
+ * runs a task and wakes every thread if it was the last one
+ */
+static void run_task(pool_t *pool, size_t index, void *task) {
+    pool->run(pool, index, task, pool->arg);
+    if (__atomic_sub_fetch(&pool->outstanding, 1, __ATOMIC_SEQ_CST) == 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/*
+ * runs tasks until none are queued or running, sleeping while there is
+ * nothing to take
+ *
+ * arg - struct worker of the thread
+ * returns NULL
+ */
+static void *run_worker(void *arg) {
+    struct worker *worker = arg;
+    pool_t *pool = worker->pool;
+    while (1) {
+        void *task = take_task(pool, worker->index);
+        if (task) {
+            run_task(pool, worker->index, task);
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        while (__atomic_load_n(&pool->outstanding, __ATOMIC_SEQ_CST) &&
+               !__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST)) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        int done = !__atomic_load_n(&pool->outstanding, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->lock);
+        if (done) {
+            return NULL;
+        }
+    }
+}
+
+/*
+ * runs first on the calling thread, then every task queued from it on
+ * the pool's threads, and returns once all of them have run
+ *
+ * pool - pool to run
+ * first - first task
+ */
+void pool_run(pool_t *pool, void *first) {
+    // a first task that queues nothing never starts a thread
+    __atomic_add_fetch(&pool->outstanding, 1, __ATOMIC_SEQ_CST);
+    run_task(pool, 0, first);
+    if (!__atomic_load_n(&pool->outstanding, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+
+    size_t started = 1;
+    for (; started < pool->count; started++) {
+        if (pthread_create(&pool->threads[started], NULL, run_worker,
+                           &pool->workers[started]) != 0) {
+            break;
+        }
+    }
+    run_worker(&pool->workers[0]);
+    for (size_t i = 1; i < started; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stddef.h>
+
+typedef struct pool pool_t;
+
+/*
+ * runs one task of a pool
+ *
+ * pool - pool the task came from, to push more tasks to
+ * worker - index of the thread running it, below pool_threads
+ * task - task to run
+ * arg - arg given to init_pool
+ */
+typedef void (*pool_run_t)(pool_t *pool, size_t worker, void *task,
+                           void *arg);
+
+/*
+ * initializes a pool of work-stealing threads, one per CPU up to
+ * max_threads
+ * no thread starts until pool_run has run its first task and found more
+ * queued
+ *
+ * max_threads - most threads the pool uses, counting the caller's
+ * run - function that runs a task
+ * arg - passed to run
+ * returns pointer, NULL on failure
+ */
+pool_t *init_pool(size_t max_threads, pool_run_t run, void *arg);
+
+/*
+ * cleans up a pool after pool_run returned
+ * Note: this function will free the pool pointer
+ */
+void cleanup_pool(pool_t *pool);
+
+/*
+ * gets the number of threads a pool can run tasks on, so callers can
+ * keep one scratch buffer per worker index
+ */
+size_t pool_threads(const pool_t *pool);
+
+/*
+ * queues a task on a worker's deque and wakes a thread to run it
+ * the worker runs its newest task next, so a tree is walked depth first,
+ * and idle threads steal the oldest task of another worker
+ *
+ * pool - pool to queue on
+ * worker - index of the thread queueing it
+ * task - task to queue
+ * returns 0 on success, -1 on allocation failure
+ */
+int pool_push(pool_t *pool, size_t worker, void *task);
+
+/*
+ * runs first on the calling thread, then every task queued from it on
+ * the pool's threads, and returns once all of them have run
+ *
+ * pool - pool to run
+ * first - first task
+ */
+void pool_run(pool_t *pool, void *first);
+
+#endif  // POOL_H_
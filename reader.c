@@ -0,0 +1,184 @@
+#include "./reader.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// initial size of the input buffer; every read asks for as much as will fit
+#define READER_BUFFER_SIZE 65536
+
+// buffer holds unconsumed input in [start, end)
+// lines are handed out in place; the partial line left at the tail of
+// the buffer is moved back to the front before the next read
+// the buffer doubles when one line fills it, up to max_size
+struct line_reader {
+    int fd;
+    char *buffer;
+    size_t size;
+    size_t max_size;
+    size_t start;
+    size_t end;
+    int eof;         // 1 once read has returned 0
+    int discarding;  // 1 while skipping the rest of an overlong line
+};
+
+/* initializes a line reader on fd, returns pointer or NULL on failure */
+line_reader_t *init_line_reader(int fd) {
+    line_reader_t *reader = (line_reader_t *)malloc(sizeof(line_reader_t));
+    if (reader == NULL) {
+        return NULL;
+    }
+
+    // one spare byte so a final unterminated line can be null terminated
+    reader->buffer = (char *)malloc(READER_BUFFER_SIZE + 1);
+    if (reader->buffer == NULL) {
+        free(reader);
+        return NULL;
+    }
+
+    // a command line is only useful up to the kernel's argument limit
+    long arg_max = sysconf(_SC_ARG_MAX);
+    reader->max_size = arg_max > READER_BUFFER_SIZE ? (size_t)arg_max
+                                                    : READER_BUFFER_SIZE;
+
+    reader->fd = fd;
+    reader->size = READER_BUFFER_SIZE;
+    reader->start = 0;
+    reader->end = 0;
+    reader->eof = 0;
+    reader->discarding = 0;
+    return reader;
+}
+
+/*
+ * cleans up line reader
+ * Note: this function will free the reader pointer but not close its fd
+ */
+void cleanup_line_reader(line_reader_t *reader) {
+    if (reader == NULL) {
+        return;
+    }
+
+    free(reader->buffer);
+    free(reader);
+}
+
+/*
+ * refills the buffer with a single read after moving any partial line to
+ * the front
+ *
+ * returns number of bytes read, 0 on EOF, -1 on error
+ */
+static ssize_t fill_buffer(line_reader_t *reader) {
+    if (reader->start > 0) {
+        memmove(reader->buffer, reader->buffer + reader->start,
+                reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+
+    ssize_t bytes_read;
+    do {
+        bytes_read = read(reader->fd, reader->buffer + reader->end,
+                          reader->size - reader->end);
+    } while (bytes_read < 0 && errno == EINTR);
+
+    if (bytes_read > 0) {
+        reader->end += (size_t)bytes_read;
+    } else if (bytes_read == 0) {
+        reader->eof = 1;
+    }
+    return bytes_read;
+}
+
+/*
+ * doubles the buffer, up to max_size
+ *
+ * returns 0 on success, -1 if the buffer is at max_size or on failure
+ */
+static int grow_buffer(line_reader_t *reader) {
+    if (reader->discarding || reader->size >= reader->max_size) {
+        return -1;
+    }
+
+    size_t size = reader->size * 2;
+    if (size > reader->max_size) {
+        size = reader->max_size;
+    }
+
+    char *buffer = (char *)realloc(reader->buffer, size + 1);
+    if (buffer == NULL) {
+        return -1;
+    }
+    reader->buffer = buffer;
+    reader->size = size;
+    return 0;
+}
+
+/*
+ * gets the next complete line from the reader
+ * the trailing newline is replaced by a null terminator, and the line stays
+ * valid until the next call to read_line
+ * a final line without a newline is returned once the fd reaches EOF
+ *
+ * line - pointer to store start of the line
+ * returns length of line, -1 on EOF, -2 on read error
+ */
+ssize_t read_line(line_reader_t *reader, char **line) {
+    if (reader == NULL || line == NULL) {
+        return -2;
+    }
+
+    size_t scanned = reader->start;
+    while (1) {
+        char *newline = memchr(reader->buffer + scanned, '\n',
+                               reader->end - scanned);
+        if (newline != NULL) {
+            char *begin = reader->buffer + reader->start;
+            *newline = '\0';
+            reader->start = (size_t)(newline - reader->buffer) + 1;
+
+            if (reader->discarding) {
+                reader->discarding = 0;
+                scanned = reader->start;
+                continue;
+            }
+
+            *line = begin;
+            return newline - begin;
+        }
+
+        // final line without a trailing newline
+        if (reader->eof) {
+            if (reader->start == reader->end || reader->discarding) {
+                reader->start = reader->end;
+                return -1;
+            }
+            char *begin = reader->buffer + reader->start;
+            size_t length = reader->end - reader->start;
+            begin[length] = '\0';
+            reader->start = reader->end;
+            *line = begin;
+            return (ssize_t)length;
+        }
+
+        // a single line filled the whole buffer, grow it or drop the line
+        if (reader->start == 0 && reader->end == reader->size) {
+            if (grow_buffer(reader) < 0) {
+                if (!reader->discarding) {
+                    fprintf(stderr, "ERROR: Input line too long\n");
+                }
+                reader->discarding = 1;
+                reader->end = 0;
+            }
+        }
+
+        size_t pending = reader->end - reader->start;
+        if (fill_buffer(reader) < 0) {
+            perror("read");
+            return -2;
+        }
+        scanned = reader->start + pending;
+    }
+}
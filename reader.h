@@ -0,0 +1,27 @@
+#ifndef READER_H_
+#define READER_H_
+
+#include <sys/types.h>
+
+typedef struct line_reader line_reader_t;
+
+/* initializes a line reader on fd, returns pointer or NULL on failure */
+line_reader_t *init_line_reader(int fd);
+/*
+ * cleans up line reader
+ * Note: this function will free the reader pointer but not close its fd
+ */
+void cleanup_line_reader(line_reader_t *reader);
+
+/*
+ * gets the next complete line from the reader
+ * the trailing newline is replaced by a null terminator, and the line stays
+ * valid until the next call to read_line
+ * a final line without a newline is returned once the fd reaches EOF
+ *
+ * line - pointer to store start of the line
+ * returns length of line, -1 on EOF, -2 on read error
+ */
+ssize_t read_line(line_reader_t *reader, char **line);
+
+#endif  // READER_H_
@@ -0,0 +1,257 @@
+#include "./redirect.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// lowest fd save_fds copies an fd to, above the ones scripts usually name
+#define SAVED_FD_BASE 10
+
+/*
+ * gets the open flags of a redirection that opens a file
+ */
+static int open_flags(redirect_type_t type) {
+    switch (type) {
+        case REDIRECT_INPUT:
+            return O_RDONLY;
+        case REDIRECT_OUTPUT:
+            return O_WRONLY | O_CREAT | O_TRUNC;
+        case REDIRECT_APPEND:
+            return O_WRONLY | O_CREAT | O_APPEND;
+        default:
+            return O_RDWR | O_CREAT;
+    }
+}
+
+/*
+ * opens a file onto an fd of the calling process
+ *
+ * file - file to open
+ * flags - open flags
+ * target - fd to replace
+ * returns 0 on success, -1 on error
+ */
+static int redirect_fd(const char *file, int flags, int target) {
+    int fd = open(file, flags | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(file);
+        return -1;
+    }
+    if (fd == target) {
+        // target was closed, so the file landed on it with close-on-exec set
+        return fcntl(fd, F_SETFD, 0);
+    }
+    int status = dup2(fd, target);
+    if (status < 0) {
+        perror("dup2");
+    }
+    close(fd);
+    return status < 0 ? -1 : 0;
+}
+
+/*
+ * applies redirections to the calling process, in order
+ * files are opened close-on-exec and moved onto their fd with dup2, which
+ * leaves the fd itself inherited by exec
+ *
+ * list - redirections to apply
+ * returns 0 on success, -1 after printing an error
+ */
+int apply_redirects(const redirect_t *list) {
+    for (const redirect_t *r = list; r != NULL; r = r->next) {
+        if (r->type == REDIRECT_CLOSE) {
+            // closing an fd that is not open is not an error
+            close(r->fd);
+        } else if (r->type == REDIRECT_DUP) {
+            int status = r->target == r->fd ? fcntl(r->fd, F_SETFD, 0)
+                                            : dup2(r->target, r->fd);
+            if (status < 0) {
+                fprintf(stderr, "ERROR: %d: %s\n", r->target,
+                        strerror(errno));
+                return -1;
+            }
+        } else if (redirect_fd(r->file, open_flags(r->type), r->fd) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * gets the lowest fd above every fd a list names, so copies kept there
+ * cannot be overwritten by applying it
+ */
+static int fd_base(const redirect_t *list) {
+    int base = SAVED_FD_BASE;
+    for (const redirect_t *r = list; r != NULL; r = r->next) {
+        if (r->fd >= base) {
+            base = r->fd + 1;
+        }
+        if (r->type == REDIRECT_DUP && r->target >= base) {
+            base = r->target + 1;
+        }
+    }
+    return base;
+}
+
+/*
+ * adds redirections to posix_spawn file actions, in order, so the child
+ * applies them between fork and exec the same way apply_redirects does
+ * files are opened here rather than by the child, whose failure would
+ * only say that the program could not run; each goes close-on-exec above
+ * every fd the list names and the child dup2s it onto its fd
+ *
+ * actions - file actions to add to
+ * list - redirections to add
+ * opened - one slot per redirection, as count_redirects returns, set to
+ *          the fd opened for it or -1, for close_redirect_fds
+ * returns 0 on success, -1 after printing an error
+ */
+int add_redirect_actions(posix_spawn_file_actions_t *actions,
+                         const redirect_t *list, int *opened) {
+    size_t count = count_redirects(list);
+    for (size_t i = 0; i < count; i++) {
+        opened[i] = -1;
+    }
+
+    int base = fd_base(list);
+    size_t i = 0;
+    for (const redirect_t *r = list; r != NULL; r = r->next, i++) {
+        int error = 0;
+        if (r->type == REDIRECT_CLOSE) {
+            error = posix_spawn_file_actions_addclose(actions, r->fd);
+        } else if (r->type == REDIRECT_DUP) {
+            // dup2 onto the same fd only clears close-on-exec
+            error = posix_spawn_file_actions_adddup2(actions, r->target,
+                                                     r->fd);
+        } else {
+            int fd = open(r->file, open_flags(r->type) | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                perror(r->file);
+                return -1;
+            }
+            opened[i] = fd >= base ? fd : fcntl(fd, F_DUPFD_CLOEXEC, base);
+            if (opened[i] != fd) {
+                close(fd);
+            }
+            if (opened[i] < 0) {
+                perror("fcntl");
+                return -1;
+            }
+            error = posix_spawn_file_actions_adddup2(actions, opened[i],
+                                                     r->fd);
+        }
+        if (error) {
+            fprintf(stderr, "ERROR: Failed to set up redirections: %s\n",
+                    strerror(error));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * closes the fds add_redirect_actions opened, once the child has them or
+ * after it failed
+ *
+ * list - redirections given to add_redirect_actions
+ * opened - slots add_redirect_actions filled
+ */
+void close_redirect_fds(const redirect_t *list, const int *opened) {
+    size_t count = count_redirects(list);
+    for (size_t i = 0; i < count; i++) {
+        if (opened[i] >= 0) {
+            close(opened[i]);
+        }
+    }
+}
+
+/*
+ * counts the redirections in a list
+ *
+ * returns number of redirections
+ */
+size_t count_redirects(const redirect_t *list) {
+    size_t count = 0;
+    for (const redirect_t *r = list; r != NULL; r = r->next) {
+        count++;
+    }
+    return count;
+}
+
+/*
+ * checks if an earlier redirection in list changes the same fd as r
+ */
+static int changed_before(const redirect_t *list, const redirect_t *r) {
+    for (const redirect_t *p = list; p != r; p = p->next) {
+        if (p->fd == r->fd) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * saves a close-on-exec copy of every fd a list changes, so restore_fds
+ * can undo apply_redirects
+ * copies go above every fd the list names, so applying it cannot
+ * overwrite them
+ *
+ * list - redirections about to be applied
+ * saved - one slot per redirection, as count_redirects returns
+ * returns 0 on success, -1 after printing an error
+ */
+int save_fds(const redirect_t *list, saved_fd_t *saved) {
+    int base = fd_base(list);
+    size_t count = count_redirects(list);
+    for (size_t i = 0; i < count; i++) {
+        saved[i].copy = -1;
+        saved[i].flags = -1;
+    }
+
+    size_t i = 0;
+    for (const redirect_t *r = list; r != NULL; r = r->next, i++) {
+        if (changed_before(list, r)) {
+            // the first slot for this fd already holds it
+            continue;
+        }
+        saved[i].flags = fcntl(r->fd, F_GETFD);
+        if (saved[i].flags < 0) {
+            // closed now, so restore_fds closes it again
+            saved[i].flags = 0;
+            continue;
+        }
+        saved[i].copy = fcntl(r->fd, F_DUPFD_CLOEXEC, base);
+        if (saved[i].copy < 0) {
+            perror("fcntl");
+            saved[i].flags = -1;
+            restore_fds(list, saved);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * puts back the fds that save_fds saved and closes the copies
+ * fds that were closed when saved are closed again
+ *
+ * list - redirections given to save_fds
+ * saved - slots save_fds filled
+ */
+void restore_fds(const redirect_t *list, const saved_fd_t *saved) {
+    size_t i = 0;
+    for (const redirect_t *r = list; r != NULL; r = r->next, i++) {
+        if (saved[i].flags < 0) {
+            continue;
+        }
+        if (saved[i].copy < 0) {
+            close(r->fd);
+        } else {
+            dup3(saved[i].copy, r->fd,
+                 (saved[i].flags & FD_CLOEXEC) ? O_CLOEXEC : 0);
+            close(saved[i].copy);
+        }
+    }
+}
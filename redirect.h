@@ -0,0 +1,92 @@
+#ifndef REDIRECT_H_
+#define REDIRECT_H_
+
+#include <spawn.h>
+#include <stddef.h>
+
+typedef enum {
+    REDIRECT_INPUT,       // n<file, fd 0 by default
+    REDIRECT_OUTPUT,      // n>file, fd 1 by default
+    REDIRECT_APPEND,      // n>>file, fd 1 by default
+    REDIRECT_READ_WRITE,  // n<>file, fd 0 by default
+    REDIRECT_DUP,         // n>&m or n<&m: fd becomes a copy of target
+    REDIRECT_CLOSE        // n>&- or n<&-
+} redirect_type_t;
+
+// one redirection of a command, applied in the order written
+typedef struct redirect {
+    redirect_type_t type;
+    int fd;                 // fd the redirection changes
+    int target;             // fd to copy for REDIRECT_DUP
+    char *file;             // file to open, NULL for REDIRECT_DUP and CLOSE
+    int expand;             // 1 if file is kept as written
+    struct redirect *next;  // next redirection, NULL if last
+} redirect_t;
+
+// an fd saved by save_fds
+typedef struct saved_fd {
+    int copy;   // close-on-exec copy of the fd, -1 if it was closed
+    int flags;  // fd flags to restore, -1 if the slot saved nothing
+} saved_fd_t;
+
+/*
+ * applies redirections to the calling process, in order
+ * files are opened close-on-exec and moved onto their fd with dup2, which
+ * leaves the fd itself inherited by exec
+ *
+ * list - redirections to apply
+ * returns 0 on success, -1 after printing an error
+ */
+int apply_redirects(const redirect_t *list);
+
+/*
+ * adds redirections to posix_spawn file actions, in order, so the child
+ * applies them between fork and exec the same way apply_redirects does
+ * files are opened by the calling process, so an error names the file,
+ * and the child only moves them onto their fds
+ *
+ * actions - file actions to add to
+ * list - redirections to add
+ * opened - one slot per redirection, as count_redirects returns, set to
+ *          the fd opened for it or -1, for close_redirect_fds
+ * returns 0 on success, -1 after printing an error
+ */
+int add_redirect_actions(posix_spawn_file_actions_t *actions,
+                         const redirect_t *list, int *opened);
+
+/*
+ * closes the fds add_redirect_actions opened, once the child has them or
+ * after it failed
+ *
+ * list - redirections given to add_redirect_actions
+ * opened - slots add_redirect_actions filled
+ */
+void close_redirect_fds(const redirect_t *list, const int *opened);
+
+/*
+ * counts the redirections in a list
+ *
+ * returns number of redirections
+ */
+size_t count_redirects(const redirect_t *list);
+
+/*
+ * saves a close-on-exec copy of every fd a list changes, so restore_fds
+ * can undo apply_redirects
+ *
+ * list - redirections about to be applied
+ * saved - one slot per redirection, as count_redirects returns
+ * returns 0 on success, -1 after printing an error
+ */
+int save_fds(const redirect_t *list, saved_fd_t *saved);
+
+/*
+ * puts back the fds that save_fds saved and closes the copies
+ * fds that were closed when saved are closed again
+ *
+ * list - redirections given to save_fds
+ * saved - slots save_fds filled
+ */
+void restore_fds(const redirect_t *list, const saved_fd_t *saved);
+
+#endif  // REDIRECT_H_
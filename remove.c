@@ -0,0 +1,364 @@
+#include "./remove.h"
+#include "./getdents.h"
+#include "./pool.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define REMOVE_MAX_THREADS 16     // most threads one remove_tree starts
+
+// a directory to empty and then remove
+// pending counts the scan of the directory itself plus every subdirectory
+// that is not removed yet; whoever drops it to 0 removes the directory
+// opening counts the scan plus every subdirectory that has not opened
+// itself from fd yet; whoever drops it to 0 closes fd, so a deep tree
+// only keeps the directories being scanned open
+struct task {
+    struct task *parent;  // NULL for the top directory
+    int fd;               // fd of the directory, -1 until it is opened
+    int failed;           // 1 if something under it was not removed
+    long pending;
+    long opening;
+    dev_t dev;            // identity of the directory, to check that ".."
+    ino_t ino;            // of a subdirectory still leads back to it
+    char name[];          // name in parent, or the path of the top one
+};
+
+// state shared by the tasks of one remove_tree call
+struct removal {
+    int force;
+    int status;     // -1 if the top directory was not removed
+    char *buffers;  // DIRENT_BUFFER_SIZE bytes per worker for getdents64
+    const volatile sig_atomic_t *cancel;  // nonzero once asked to stop
+};
+
+/*
+ * says if the caller asked the removal to stop
+ * a stopped task is marked failed without an error, so it and the
+ * directories above it are left in place
+ */
+static int cancelled(const struct removal *removal) {
+    return removal->cancel &&
+           __atomic_load_n(removal->cancel, __ATOMIC_RELAXED);
+}
+
+/*
+ * prints why a file could not be removed
+ * ENOENT is left out with -f, since the file is gone either way
+ *
+ * returns 0 if the error was left out, -1 if it counts
+ */
+static int report(const struct removal *removal, const char *name,
+                  int error) {
+    if (removal->force && error == ENOENT) {
+        return 0;
+    }
+    char message[128];
+    fprintf(stderr, "rm: %s: %s\n", name,
+            strerror_r(error, message, sizeof(message)));
+    return -1;
+}
+
+/*
+ * allocates a task for a directory
+ *
+ * parent - task of the directory it is in, NULL for the top directory
+ * name - name of the directory in parent
+ * returns task, NULL on allocation failure
+ */
+static struct task *new_task(struct task *parent, const char *name) {
+    size_t length = strlen(name);
+    struct task *task = malloc(sizeof(struct task) + length + 1);
+    if (!task) {
+        return NULL;
+    }
+    task->parent = parent;
+    task->fd = -1;
+    task->failed = 0;
+    task->pending = 1;
+    task->opening = 1;
+    task->dev = 0;
+    task->ino = 0;
+    memcpy(task->name, name, length + 1);
+    return task;
+}
+
+/*
+ * drops one reference to a directory's fd, closing it after the last
+ */
+static void release_fd(struct task *task) {
+    if (__atomic_sub_fetch(&task->opening, 1, __ATOMIC_ACQ_REL) == 0) {
+        close(task->fd);
+    }
+}
+
+/*
+ * opens the directory a task's directory is in through ".." of an fd of
+ * it, so removing it needs no fd of the parent kept open
+ * the result must be the parent's directory, or the tree was moved while
+ * it was being removed
+ *
+ * removal - state of the call
+ * task - task whose parent to open
+ * fd - fd of the task's directory
+ * returns fd of the parent, AT_FDCWD for the top directory, -1 after
+ * printing an error
+ */
+static int open_parent(struct removal *removal, const struct task *task,
+                       int fd) {
+    const struct task *parent = task->parent;
+    if (!parent) {
+        return AT_FDCWD;
+    }
+    int parent_fd = openat(fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (parent_fd < 0) {
+        report(removal, parent->name, errno);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(parent_fd, &st) < 0 || st.st_dev != parent->dev ||
+        st.st_ino != parent->ino) {
+        report(removal, parent->name, ESTALE);
+        close(parent_fd);
+        return -1;
+    }
+    return parent_fd;
+}
+
+/*
+ * removes a directory nothing is left under, which in turn drops a
+ * reference to its parent and removes that too if it was the last
+ * a directory with a failure under it is not removed, since rmdir could
+ * only fail, and the failure is passed up instead
+ *
+ * removal - state of the call
+ * task - directory to remove
+ * fd - fd of the directory, closed here, or -1 if it failed
+ */
+static void remove_task(struct removal *removal, struct task *task, int fd) {
+    while (1) {
+        struct task *parent = task->parent;
+        int failed = __atomic_load_n(&task->failed, __ATOMIC_ACQUIRE);
+        int parent_fd = parent ? -1 : AT_FDCWD;
+        if (!failed && parent) {
+            parent_fd = open_parent(removal, task, fd);
+            failed = parent_fd < 0;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (!failed &&
+            unlinkat(parent_fd, task->name, AT_REMOVEDIR) < 0) {
+            failed = report(removal, task->name, errno) < 0;
+        }
+        free(task);
+
+        if (!parent) {
+            removal->status = failed ? -1 : 0;
+            return;
+        }
+        if (failed) {
+            __atomic_store_n(&parent->failed, 1, __ATOMIC_RELEASE);
+            if (parent_fd >= 0) {
+                close(parent_fd);
+            }
+            parent_fd = -1;
+        }
+        if (__atomic_sub_fetch(&parent->pending, 1, __ATOMIC_ACQ_REL) != 0) {
+            if (parent_fd >= 0) {
+                close(parent_fd);
+            }
+            return;
+        }
+        task = parent;
+        fd = parent_fd;
+    }
+}
+
+/*
+ * drops one reference to a directory, removing it if it was the last
+ *
+ * removal - state of the call
+ * task - directory to drop a reference to
+ * fd - fd of the directory, closed here, or -1 if it failed
+ */
+static void finish_task(struct removal *removal, struct task *task, int fd) {
+    if (__atomic_sub_fetch(&task->pending, 1, __ATOMIC_ACQ_REL) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    remove_task(removal, task, fd);
+}
+
+/*
+ * empties one directory: files are unlinked right away and each
+ * subdirectory becomes a task on this thread's deque
+ *
+ * pool - pool running the task
+ * worker - index of the thread running it
+ * arg - struct task of the directory
+ * removal_arg - struct removal of the call
+ */
+static void run_task(pool_t *pool, size_t worker, void *arg,
+                     void *removal_arg) {
+    struct task *task = arg;
+    struct removal *removal = removal_arg;
+    char *buffer = removal->buffers + worker * DIRENT_BUFFER_SIZE;
+    int parent_fd = task->parent ? task->parent->fd : AT_FDCWD;
+    int cancel = cancelled(removal);
+    task->fd = cancel ? -1
+                      : openat(parent_fd, task->name,
+                               O_RDONLY | O_DIRECTORY | O_NOFOLLOW |
+                                   O_CLOEXEC);
+    struct stat st;
+    if (task->fd >= 0 && fstat(task->fd, &st) < 0) {
+        int error = errno;
+        close(task->fd);
+        task->fd = -1;
+        errno = error;
+    }
+    if (task->fd < 0) {
+        // a directory that is already gone needs no removal, but its
+        // parent still does, so it gets an fd of the parent just as a
+        // removed subdirectory would pass up
+        struct task *parent = task->parent;
+        int failed = cancel || report(removal, task->name, errno) < 0;
+        int fd = -1;
+        if (!failed && parent) {
+            fd = fcntl(parent->fd, F_DUPFD_CLOEXEC, 0);
+            failed = fd < 0 && report(removal, parent->name, errno) < 0;
+        }
+        free(task);
+        if (!parent) {
+            removal->status = failed ? -1 : 0;
+            return;
+        }
+        if (failed) {
+            __atomic_store_n(&parent->failed, 1, __ATOMIC_RELEASE);
+        }
+        release_fd(parent);
+        finish_task(removal, parent, fd);
+        return;
+    }
+    if (task->parent) {
+        release_fd(task->parent);
+    }
+    task->dev = st.st_dev;
+    task->ino = st.st_ino;
+
+    while (1) {
+        if (cancelled(removal)) {
+            __atomic_store_n(&task->failed, 1, __ATOMIC_RELEASE);
+            break;
+        }
+        long size = syscall(SYS_getdents64, task->fd, buffer,
+                            DIRENT_BUFFER_SIZE);
+        if (size <= 0) {
+            if (size < 0) {
+                report(removal, task->name, errno);
+                __atomic_store_n(&task->failed, 1, __ATOMIC_RELEASE);
+            }
+            break;
+        }
+        for (long offset = 0; offset < size;) {
+            struct dirent_record *record =
+                (struct dirent_record *)(void *)(buffer + offset);
+            offset += record->d_reclen;
+            const char *name = record->d_name;
+            if (name[0] == '.' &&
+                (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            // file systems that do not fill in d_type need a stat
+            int is_dir = record->d_type == DT_DIR;
+            if (record->d_type == DT_UNKNOWN &&
+                fstatat(task->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                is_dir = S_ISDIR(st.st_mode);
+            }
+            if (!is_dir) {
+                if (unlinkat(task->fd, name, 0) < 0 &&
+                    report(removal, name, errno) < 0) {
+                    __atomic_store_n(&task->failed, 1, __ATOMIC_RELEASE);
+                }
+                continue;
+            }
+
+            struct task *child = new_task(task, name);
+            __atomic_add_fetch(&task->pending, 1, __ATOMIC_ACQ_REL);
+            __atomic_add_fetch(&task->opening, 1, __ATOMIC_ACQ_REL);
+            if (!child || pool_push(pool, worker, child) < 0) {
+                report(removal, name, ENOMEM);
+                free(child);
+                __atomic_store_n(&task->failed, 1, __ATOMIC_RELEASE);
+                __atomic_sub_fetch(&task->opening, 1, __ATOMIC_ACQ_REL);
+                __atomic_sub_fetch(&task->pending, 1, __ATOMIC_ACQ_REL);
+            }
+        }
+    }
+
+    // the scan's reference may turn out to be the last one, so it keeps
+    // an fd of the directory: fd itself if every subdirectory has opened
+    // already, otherwise a dup, since the last one to open closes fd
+    int fd = -1;
+    if (__atomic_load_n(&task->opening, __ATOMIC_ACQUIRE) > 1 &&
+        (fd = fcntl(task->fd, F_DUPFD_CLOEXEC, 0)) < 0) {
+        report(removal, task->name, errno);
+        __atomic_store_n(&task->failed, 1, __ATOMIC_RELEASE);
+    }
+    if (__atomic_sub_fetch(&task->opening, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        fd = task->fd;
+    }
+    finish_task(removal, task, fd);
+}
+
+/*
+ * removes a directory and everything under it
+ * directories are read with getdents64 and emptied with unlinkat relative
+ * to an fd of the directory, so no path is ever resolved twice; each
+ * directory is a task on a pool of threads that steal tasks from each
+ * other, one per CPU up to REMOVE_MAX_THREADS, and a directory is removed
+ * by whichever thread finishes its last subdirectory
+ * errors are printed and the rest of the tree is still removed
+ * once cancel is set, such as from a SIGINT handler, no task reads
+ * another batch of entries or opens another directory, and whatever is
+ * left stays in place
+ *
+ * path - directory to remove, which is not followed if it is a symlink
+ * force - 1 to say nothing about files that are already gone
+ * cancel - flag to stop early, or NULL
+ * returns 0 on success, -1 if anything could not be removed or it was
+ * stopped
+ */
+int remove_tree(const char *path, int force,
+                const volatile sig_atomic_t *cancel) {
+    struct removal removal = {force, -1, NULL, cancel};
+    pool_t *pool = init_pool(REMOVE_MAX_THREADS, run_task, &removal);
+    struct task *top = new_task(NULL, path);
+    if (pool) {
+        removal.buffers = malloc(pool_threads(pool) * DIRENT_BUFFER_SIZE);
+    }
+    if (!pool || !top || !removal.buffers) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        cleanup_pool(pool);
+        free(top);
+        free(removal.buffers);
+        return -1;
+    }
+
+    pool_run(pool, top);
+    cleanup_pool(pool);
+    free(removal.buffers);
+    return removal.status;
+}
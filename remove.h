@@ -0,0 +1,27 @@
+#ifndef REMOVE_H_
+#define REMOVE_H_
+
+#include <signal.h>
+
+/*
+ * removes a directory and everything under it
+ * directories are read with getdents64 and emptied with unlinkat relative
+ * to an fd of the directory, so no path is ever resolved twice; each
+ * directory is a task on a pool of threads that steal tasks from each
+ * other, one per CPU up to REMOVE_MAX_THREADS, and a directory is removed
+ * by whichever thread finishes its last subdirectory
+ * errors are printed and the rest of the tree is still removed
+ * once cancel is set, such as from a SIGINT handler, no task reads
+ * another batch of entries or opens another directory, and whatever is
+ * left stays in place
+ *
+ * path - directory to remove, which is not followed if it is a symlink
+ * force - 1 to say nothing about files that are already gone
+ * cancel - flag to stop early, or NULL
+ * returns 0 on success, -1 if anything could not be removed or it was
+ * stopped
+ */
+int remove_tree(const char *path, int force,
+                const volatile sig_atomic_t *cancel);
+
+#endif  // REMOVE_H_
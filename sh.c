@@ -1,44 +1,259 @@
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <spawn.h>
 #include <ctype.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include "./arena.h"
+#include "./copy.h"
 #include "./jobs.h"
+#include "./lex.h"
+#include "./path.h"
+#include "./reader.h"
+#include "./redirect.h"
+#include "./remove.h"
+#include "./util.h"
 
 #define BUFFER_SIZE 1024
-#define MAX_TOKENS 512
+#define ARENA_CHUNK_SIZE 16384       // fits the argv of most command lines
+#define INITIAL_ARGS 64              // argv size before it has to grow
+#define MAX_SCRIPT_DEPTH 64          // limit on nested source builtins
+#define PARSE_CACHE_SIZE 256         // slots in the parse cache
+#define PARSE_CACHE_MAX_LINE 4096    // longer lines are not cached
+#define PARSE_CACHE_CHUNK_SIZE 1024  // arena chunk size of a cached line
+#define INITIAL_CODE 32              // instructions before a program grows
+#define INITIAL_WORDS 8              // for and case words before they grow
+#define PARSE_COMPOUND 2             // parse status of a compound command
+#define LAUNCH_BUCKETS 96            // launch latency buckets, up to ~16 s
+#define TIMEOUT_KILL_AFTER 5         // seconds from SIGTERM to SIGKILL
+#define WATCH_INTERVAL 2             // seconds between runs of watch
 
 // global variables for job control
 static job_list_t *job_list;        // list of all background and stopped jobs
 static pid_t fg_pid = -1;           // pid of current foreground job
 static int next_jid = 1;            // next available jid
 static int foreground_job_id = -1;  // jid of current foreground job
+static int job_control = 0;         // 1 when stdin is the shell's terminal
+static int last_status = 0;         // exit status of the last command
+static volatile sig_atomic_t interrupted = 0;  // set by catch_interrupt
+
+// full paths of commands found in PATH, allocated on the first lookup
+static path_cache_t *path_cache;
+
+// storage for the command being run, reset after every line
+static arena_t *command_arena;
+static int script_depth = 0;  // number of scripts currently being run
+
+// shell variable set by NAME=value or a for loop
+struct shell_var {
+    char *name;
+    char *value;
+    size_t capacity;  // bytes allocated for value
+};
+
+static struct shell_var *shell_vars;
+static size_t shell_var_count = 0;
+static size_t shell_var_capacity = 0;
 
 // command types
 enum command_type {
     CMD_REGULAR,  // regular
-    CMD_FG,       // fg
-    CMD_BG,       // bg
-    CMD_JOBS      // jobs commands
+    CMD_ASSIGN    // NAME=value
+};
+
+// how a command in a list is joined to the command before it
+enum list_op {
+    LIST_SEQ,  // ; or &, or first command: always runs
+    LIST_AND,  // &&: runs if the previous status was 0
+    LIST_OR,   // ||: runs if the previous status was not 0
+    LIST_PIPE  // |: runs with its stdin reading the previous command's stdout
 };
 
 // struct to hold parsed command information
+// a line with ;, &, &&, || or | holds a list of these linked through next
 struct parse_result {
     char *command_path;          // full path to executable
-    char *input_file;            // input redirection
-    char *output_file;           // output redirection
-    int append_mode;             // 1 if >>, 0 if >
-    char *argv[MAX_TOKENS];      // args
+    redirect_t *redirects;       // redirections in the order written
+    char **argv;                 // args, null terminated
+    unsigned char *expand_argv;  // 1 for each arg kept as written, or NULL
+    int expand_redirects;        // 1 if a redirected file is kept as written
     int background;              // if command ends with &
     enum command_type cmd_type;  // type of command
+    const struct builtin *builtin;  // descriptor of a builtin, or NULL
     int job_id;                  // jid for fg/bg commands (-1 if N/A)
+    enum list_op op;             // how this command joins the previous one
+    struct parse_result *next;   // next command in the list, NULL if last
+};
+
+// what a builtin can do besides run in the shell
+#define BUILTIN_BACKGROUND 0x1  // runs in a forked child when given &
+#define BUILTIN_REDIRECT 0x2    // redirections are undone once it returns
+#define BUILTIN_STREAM 0x4      // only moves data, runs in the shell in a
+                                // pipeline without job control and is
+                                // forked with it
+#define BUILTIN_LOOP 0x8        // break and continue, run by run_list
+#define BUILTIN_JOB 0x10        // fg and bg, which take a %job argument
+#define BUILTIN_STATUS 0x20     // sets last_status itself when it returns 1
+
+// descriptor of a builtin, found by find_builtin
+struct builtin {
+    const char *name;
+    int (*run)(struct parse_result *result);  // returns 1 or -1 on error
+    int min_args;       // fewest arguments after the name
+    int max_args;       // most arguments after the name, -1 if unlimited
+    const char *usage;  // printed when the argument count is wrong
+    unsigned flags;     // BUILTIN_ flags
+};
+
+// parsed line kept by the parse cache
+// line is the raw line used as the key, and arena owns line, argv and the
+// words they point to
+struct parse_cache_entry {
+    uint64_t hash;
+    size_t length;
+    char *line;
+    arena_t *arena;  // NULL if the slot is empty
+    struct parse_result result;
+    int in_use;  // number of runs of this line in progress
+};
+
+// direct-mapped cache from raw line to parse result
+static struct parse_cache_entry parse_cache[PARSE_CACHE_SIZE];
+static arena_t *parse_cache_spare;  // arena the next miss is parsed into
+static unsigned long parse_cache_hits = 0;
+static unsigned long parse_cache_misses = 0;
+
+// arena chunks malloc'd while running the last line; 0 once the arenas
+// have grown to fit the lines being run
+static size_t last_line_mallocs = 0;
+
+// histogram of the time posix_spawn takes to launch a command, in
+// microseconds; each power of two is split into 4 buckets
+static unsigned long launch_latency[LAUNCH_BUCKETS];
+static unsigned long launch_count = 0;
+
+// where lines of input come from: stdin through a reader, or a block of
+// text from a script or -c
+struct line_source {
+    line_reader_t *reader;  // NULL for text
+    char *text;             // next unread byte of text
+    char *end;              // end of text
+    int terminated;         // 1 if *end is a null terminator
+    char *tail;             // copy of a final unterminated line, or NULL
+};
+
+// tokens of a command; while a compound command is open, the end of a line
+// reads the next one from source
+struct token_stream {
+    lexer_t lexer;
+    struct line_source *source;  // NULL to stop at the end of the line
+    arena_t *arena;              // arena to copy lines from stdin into
+    int depth;                   // number of open compound commands
+};
+
+// how control leaves a command list
+enum flow {
+    FLOW_NEXT,     // on to the next instruction
+    FLOW_BREAK,    // out of the innermost loop
+    FLOW_CONTINUE  // on to the next pass of the innermost loop
+};
+
+// instructions compound commands are compiled to
+enum opcode {
+    OP_RUN,         // runs a command list
+    OP_JUMP,        // jumps to target
+    OP_JUMP_FALSE,  // jumps to target if the last status is not 0
+    OP_JUMP_TRUE,   // jumps to target if the last status is 0
+    OP_FOR_INIT,    // starts a for loop from its first word
+    OP_FOR_NEXT,    // sets the next word, jumps to target when none are left
+    OP_MATCH,       // jumps to target unless a case pattern matches
+    OP_TRUE         // sets the last status to 0
+};
+
+// words of a for loop or case item, with their expand flags
+struct word_list {
+    char **words;
+    unsigned char *expand;  // 1 for each word kept as written
+    size_t count;
+    size_t capacity;
+};
+
+// for loop variable, its words and the index of the next one
+struct for_loop {
+    char *name;
+    struct word_list list;
+    size_t index;
+};
+
+// word a case command matches, and the patterns of one of its items
+struct case_item {
+    char *word;
+    int expand;  // 1 if word is kept as written
+    struct word_list patterns;
+};
+
+// where break and continue go in the innermost loop
+struct loop_targets {
+    size_t next;
+    size_t exit;
+};
+
+struct instruction {
+    enum opcode op;
+    size_t target;               // jump target
+    void *operand;               // command list, for_loop or case_item
+    struct loop_targets *loop;   // innermost loop, NULL if none
+};
+
+// state of the compiler: tokens it reads and the program it builds
+struct compiler {
+    struct token_stream stream;
+    token_t token;               // current token
+    struct instruction *code;
+    size_t count;
+    size_t capacity;
+    struct loop_targets *loop;   // innermost loop being compiled, or NULL
 };
 
+/*
+ * gets the job list, allocating it the first time a job is added
+ * so commands that never create jobs skip the allocation
+ *
+ * returns job list, NULL on allocation failure
+ */
+static job_list_t *ensure_job_list(void) {
+    if (!job_list) {
+        job_list = init_job_list();
+    }
+    return job_list;
+}
+
+/*
+ * gets the command cache, allocating it the first time a command is
+ * looked up in PATH
+ *
+ * returns command cache, NULL on allocation failure
+ */
+static path_cache_t *ensure_path_cache(void) {
+    if (!path_cache) {
+        path_cache = init_path_cache();
+    }
+    return path_cache;
+}
+
 /*
  * gets info about a job: suchas pid and current state
  *
@@ -57,19 +272,7 @@ static int get_job_info(int jid, pid_t *pid, process_state_t *state) {
         return -1;
     }
 
-    process_state_t current_state = RUNNING;
-    if (update_job_pid(job_list, *pid, current_state) == -1) {
-        return -1;
-    }
-
-    if (update_job_pid(job_list, *pid, STOPPED) != -1) {
-        *state = STOPPED;
-        update_job_pid(job_list, *pid, current_state);
-    } else {
-        *state = RUNNING;
-    }
-
-    return 0;
+    return get_job_state(job_list, jid, state);
 }
 
 /*
@@ -101,6 +304,9 @@ static int give_terminal_to(pid_t pgid) {
     if (pgid <= 0) {
         return -1;
     }
+    if (!job_control) {
+        return 0;
+    }
 
     if (tcsetpgrp(STDIN_FILENO, pgid) < 0) {
         perror("tcsetpgrp");
@@ -115,6 +321,10 @@ static int give_terminal_to(pid_t pgid) {
  * returns 0 on success, -1 on error
  */
 static int take_terminal_control(void) {
+    if (!job_control) {
+        return 0;
+    }
+
     pid_t shell_pgid = getpgrp();
     if (shell_pgid < 0) {
         perror("getpgrp");
@@ -129,10 +339,11 @@ static int take_terminal_control(void) {
 }
 
 /*
- * waits for a child and handles status
+ * waits for every process of a job, or for the job to stop
  *
- * pid - pid to wait for
- * status - pointer to store process status
+ * pid - process group of the job
+ * status - pointer to store the status of the process that stopped or was
+ *          reaped last
  * returns -1 on error, 0 on regular termination, 1 if stopped
  */
 static int wait_for_job(pid_t pid, int *status) {
@@ -140,12 +351,20 @@ static int wait_for_job(pid_t pid, int *status) {
         return -1;
     }
 
-    if (waitpid(pid, status, WUNTRACED) < 0) {
-        perror("waitpid");
-        return -1;
+    while (1) {
+        pid_t reaped = waitpid(-pid, status, WUNTRACED);
+        if (reaped < 0) {
+            perror("waitpid");
+            return -1;
+        }
+        if (WIFSTOPPED(*status)) {
+            return 1;
+        }
+        // a process the job list does not know about ends the wait too
+        if (reap_job_process(job_list, reaped) <= 0) {
+            return 0;
+        }
     }
-
-    return WIFSTOPPED(*status) ? 1 : 0;
 }
 
 /*
@@ -159,6 +378,11 @@ static int reap_background_processes(void) {
     int status;
     int reaped = 0;
 
+    // no jobs have been created, so nothing can have changed state
+    if (!job_list) {
+        return 0;
+    }
+
     // check for any child that has changed state
     while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
         int jid = get_job_jid(job_list, pid);
@@ -168,20 +392,33 @@ static int reap_background_processes(void) {
             continue;
         }
 
+        // a job is reported by its process group, and a pipeline is only
+        // done once its last process has been reaped
+        pid_t job_pid = pid;
+        process_state_t state = RUNNING;
+        if (jid > 0) {
+            get_job_info(jid, &job_pid, &state);
+            if ((WIFEXITED(status) || WIFSIGNALED(status)) &&
+                reap_job_process(job_list, pid) > 0) {
+                reaped = 1;
+                continue;
+            }
+        }
+
         // handle normal termination
         if (WIFEXITED(status)) {
             if (jid > 0) {
                 fprintf(stdout, "[%d] (%d) terminated with exit status %d\n",
-                        jid, pid, WEXITSTATUS(status));
-                remove_job_pid(job_list, pid);
+                        jid, job_pid, WEXITSTATUS(status));
+                remove_job_jid(job_list, jid);
             }
         }
         // handle termination by signal
         else if (WIFSIGNALED(status)) {
             if (jid > 0) {
-                fprintf(stdout, "[%d] (%d) terminated by signal %d\n", jid, pid,
-                        WTERMSIG(status));
-                remove_job_pid(job_list, pid);
+                fprintf(stdout, "[%d] (%d) terminated by signal %d\n", jid,
+                        job_pid, WTERMSIG(status));
+                remove_job_jid(job_list, jid);
             } else {
                 fprintf(stdout, "(%d) terminated by signal %d\n", pid,
                         WTERMSIG(status));
@@ -195,7 +432,8 @@ static int reap_background_processes(void) {
                 snprintf(command_buf, sizeof(command_buf), "%s",
                          fg_pid == pid ? "fg_command" : "bg_command");
 
-                if (add_job(job_list, next_jid, pid, STOPPED, command_buf) ==
+                if (add_job(ensure_job_list(), next_jid, pid, STOPPED,
+                            command_buf) ==
                     0) {
                     jid = next_jid++;
                     fprintf(stdout, "[%d] (%d) suspended by signal %d\n", jid,
@@ -203,18 +441,20 @@ static int reap_background_processes(void) {
                 } else {
                     fprintf(stderr, "Error: Failed to add job to job list\n");
                 }
-            } else {
-                // update job status
+            } else if (state == RUNNING) {
+                // update job status once for all of its processes
                 update_job_pid(job_list, pid, STOPPED);
-                fprintf(stdout, "[%d] (%d) suspended by signal %d\n", jid, pid,
-                        WSTOPSIG(status));
+                fprintf(stdout, "[%d] (%d) suspended by signal %d\n", jid,
+                        job_pid, WSTOPSIG(status));
             }
         }
         // handle SIGCONT
         else if (WIFCONTINUED(status)) {
-            if (jid > 0) {
+            // bg has already marked the job running, so it is reported
+            // for the first process of the group only
+            if (jid > 0 && pid == job_pid) {
                 update_job_pid(job_list, pid, RUNNING);
-                fprintf(stdout, "[%d] (%d) resumed\n", jid, pid);
+                fprintf(stdout, "[%d] (%d) resumed\n", jid, job_pid);
             }
         }
         reaped = 1;
@@ -253,494 +493,3532 @@ static void init_signal_handlers(void) {
 }
 
 /*
- * checks if a string contains only whitespace characters/is empty
+ * finds a shell variable
  *
- * str - string to be checked
- * returns 1 if string is empty or all whitespace, 0 otherwise
+ * name - name of variable, not null terminated
+ * length - length of name
+ * returns pointer to variable, NULL if it is not set
  */
-static int is_empty_or_whitespace(const char *str) {
-    if (!str) {
-        return 1;
-    }
-
-    while (*str) {
-        if (!isspace((unsigned char)*str)) {
-            return 0;
+static struct shell_var *find_var(const char *name, size_t length) {
+    for (size_t i = 0; i < shell_var_count; i++) {
+        if (strncmp(shell_vars[i].name, name, length) == 0 &&
+            shell_vars[i].name[length] == '\0') {
+            return &shell_vars[i];
         }
-        str++;
     }
-    return 1;
+    return NULL;
 }
 
 /*
- * parses input into command components and stores in result struct
- * handles command parsing, I/O redirection, and background process
+ * sets a shell variable, reusing its storage when the value fits
  *
- * buffer - input string to be parsed
- * result - pointer to structure to store parsed command information
- * returns 0 on success, -1 on parsing error
+ * name - name of variable, not null terminated
+ * length - length of name
+ * value - null terminated value
+ * returns 0 on success, -1 on allocation failure
  */
-static int parse(char buffer[BUFFER_SIZE], struct parse_result *result) {
-    if (!buffer || !result || strlen(buffer) >= BUFFER_SIZE) {
-        return -1;
-    }
-
-    char *tokens[MAX_TOKENS];
-    int token_count = 0;
-    char *token;
-    int has_input_redirect = 0;
-    int has_output_redirect = 0;
-
-    // initialize result structure
-    memset(result, 0, sizeof(struct parse_result));
-    result->job_id = -1;
-
-    token = strtok(buffer, " \t\n");
-    if (!token) {
-        return -1;
-    }
-
-    // handle job control commands
-    if (strcmp(token, "fg") == 0 || strcmp(token, "bg") == 0) {
-        result->cmd_type = (strcmp(token, "fg") == 0) ? CMD_FG : CMD_BG;
-        token = strtok(NULL, " \t\n");
+static int set_var(const char *name, size_t length, const char *value) {
+    size_t size = strlen(value) + 1;
+    struct shell_var *var = find_var(name, length);
+
+    if (!var) {
+        if (shell_var_count == shell_var_capacity) {
+            size_t capacity = shell_var_capacity ? 2 * shell_var_capacity : 16;
+            struct shell_var *vars =
+                realloc(shell_vars, capacity * sizeof(struct shell_var));
+            if (!vars) {
+                return -1;
+            }
+            shell_vars = vars;
+            shell_var_capacity = capacity;
+        }
 
-        if (!token || token[0] != '%') {
-            fprintf(stderr, "ERROR: Expected %%<job-id>\n");
+        char *copy = strndup(name, length);
+        if (!copy) {
             return -1;
         }
+        var = &shell_vars[shell_var_count++];
+        var->name = copy;
+        var->value = NULL;
+        var->capacity = 0;
+    }
 
-        char *job_str = token + 1;
-        if (!isdigit((unsigned char)*job_str)) {
-            fprintf(stderr, "ERROR: Invalid job ID\n");
+    if (size > var->capacity) {
+        char *grown = realloc(var->value, size);
+        if (!grown) {
             return -1;
         }
+        var->value = grown;
+        var->capacity = size;
+    }
+    memcpy(var->value, value, size);
 
-        result->job_id = atoi(job_str);
-        result->command_path = (result->cmd_type == CMD_FG) ? "fg" : "bg";
-        result->argv[0] = result->command_path;
-        result->argv[1] = NULL;
-
-        // check for extra args
-        if (strtok(NULL, " \t\n")) {
-            fprintf(stderr, "ERROR: Too many arguments\n");
+    // PATH is exported so commands and the command cache see it, and the
+    // cache forgets what it found through the old value
+    if (length == 4 && strncmp(name, "PATH", 4) == 0) {
+        if (setenv("PATH", value, 1) < 0) {
             return -1;
         }
-
-        return 0;
+        clear_path_cache(path_cache);
     }
+    return 0;
+}
 
-    // tokenize remaining
-    while (token && token_count < MAX_TOKENS - 1) {
-        tokens[token_count++] = token;
-        token = strtok(NULL, " \t\n");
+/*
+ * looks up a name for expand_word
+ * $? is the last status, then shell variables, then the environment
+ *
+ * name - name to look up, not null terminated
+ * length - length of name
+ * returns value, NULL if it is not set
+ */
+static const char *lookup_var(const char *name, size_t length) {
+    static char status[16];
+    if (length == 1 && name[0] == '?') {
+        snprintf(status, sizeof(status), "%d", last_status);
+        return status;
     }
-    tokens[token_count] = NULL;
 
-    // check for background
-    if (token_count > 0 && strcmp(tokens[token_count - 1], "&") == 0) {
-        result->background = 1;
-        token_count--;
-        tokens[token_count] = NULL;
+    struct shell_var *var = find_var(name, length);
+    if (var) {
+        return var->value;
     }
 
-    // process command and args
-    int arg_count = 0;
-    for (int i = 0; i < token_count; i++) {
-        // handle input redirections
-        if (strcmp(tokens[i], "<") == 0) {
-            if (has_input_redirect || i + 1 >= token_count) {
-                fprintf(stderr, "ERROR: Invalid input redirection\n");
-                return -1;
-            }
-            result->input_file = tokens[++i];
-            has_input_redirect = 1;
-            continue;
-        }
+    char env_name[BUFFER_SIZE];
+    if (length >= sizeof(env_name)) {
+        return NULL;
+    }
+    memcpy(env_name, name, length);
+    env_name[length] = '\0';
+    return getenv(env_name);
+}
 
-        // handle output redirections
-        if (strcmp(tokens[i], ">") == 0 || strcmp(tokens[i], ">>") == 0) {
-            if (has_output_redirect || i + 1 >= token_count) {
-                fprintf(stderr, "ERROR: Invalid output redirection\n");
-                return -1;
-            }
-            result->output_file = tokens[++i];
-            result->append_mode = (tokens[i - 1][1] == '>');
-            has_output_redirect = 1;
-            continue;
-        }
+/*
+ * frees every shell variable
+ */
+static void cleanup_vars(void) {
+    for (size_t i = 0; i < shell_var_count; i++) {
+        free(shell_vars[i].name);
+        free(shell_vars[i].value);
+    }
+    free(shell_vars);
+    shell_vars = NULL;
+    shell_var_count = 0;
+    shell_var_capacity = 0;
+}
 
-        // handle command and args
-        if (!result->command_path) {
-            result->command_path = tokens[i];
-            // extract command name from path for argv[0]
-            char *last_slash = strrchr(tokens[i], '/');
-            result->argv[arg_count++] = last_slash ? last_slash + 1 : tokens[i];
-        } else {
-            result->argv[arg_count++] = tokens[i];
+/*
+ * gets the next line from a source
+ * lines of text are split in place; a final line with no room after it is
+ * the one line that gets copied
+ *
+ * line - pointer to store the null terminated line
+ * continuation - 1 if the line continues an open compound command
+ * returns length of line, -1 at end of input, -2 on error
+ */
+static ssize_t next_line(struct line_source *source, char **line,
+                         int continuation) {
+    if (source->reader) {
+#ifdef PROMPT
+        if (continuation && (printf("> ") < 0 || fflush(stdout) < 0)) {
+            return -2;
         }
+#else
+        (void)continuation;
+#endif
+        return read_line(source->reader, line);
     }
 
-    // validate command
-    if (!result->command_path) {
-        fprintf(stderr, "ERROR: No command specified\n");
+    if (source->text >= source->end) {
         return -1;
     }
 
-    result->argv[arg_count] = NULL;
-    return 0;
+    char *start = source->text;
+    size_t rest = (size_t)(source->end - start);
+    char *newline = memchr(start, '\n', rest);
+    if (newline) {
+        *newline = '\0';
+        source->text = newline + 1;
+        *line = start;
+        return newline - start;
+    }
+
+    source->text = source->end;
+    if (!source->terminated) {
+        free(source->tail);
+        source->tail = malloc(rest + 1);
+        if (!source->tail) {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            return -2;
+        }
+        memcpy(source->tail, start, rest);
+        source->tail[rest] = '\0';
+        start = source->tail;
+    }
+    *line = start;
+    return (ssize_t)rest;
 }
 
 /*
- * sets up input/output redirections
- * handles both input (<) and output (>, >>) redirection
+ * gets the next token of a command
+ * at the end of a line inside an open compound command, the next line is
+ * read from the source and TOKEN_NEWLINE is returned in place of TOKEN_END
  *
- * result - pointer to parsed command information struct
- * returns 0 on success, -1 on error
+ * token - pointer to store token
+ * returns 0 on success, -1 on syntax or read error
  */
-static int setup_redirections(struct parse_result *result) {
-    if (!result) {
+static int read_token(struct token_stream *stream, token_t *token) {
+    if (next_token(&stream->lexer, token) < 0) {
         return -1;
     }
+    if (token->type != TOKEN_END || stream->depth == 0 || !stream->source) {
+        return 0;
+    }
 
-    // handle input redirection
-    if (result->input_file) {
-        if (close(STDIN_FILENO) < 0) {
-            perror("close");
-            return -1;
-        }
-        if (open(result->input_file, O_RDONLY) < 0) {
-            perror("open");
-            return -1;
-        }
+    char *line;
+    ssize_t length = next_line(stream->source, &line, 1);
+    if (length == -2) {
+        return -1;
+    }
+    if (length == -1) {
+        return 0;  // the caller reports the command left open
     }
 
-    // handle output redirection
-    if (result->output_file) {
-        if (close(STDOUT_FILENO) < 0) {
-            perror("close");
+    // lines from a reader only last until its next read
+    if (stream->source->reader) {
+        char *copy = arena_alloc(stream->arena, (size_t)length + 1);
+        if (!copy) {
+            fprintf(stderr, "ERROR: Out of memory\n");
             return -1;
         }
+        memcpy(copy, line, (size_t)length + 1);
+        line = copy;
+    }
 
-        int flags = O_WRONLY | O_CREAT;
-        flags |= result->append_mode ? O_APPEND : O_TRUNC;
+    init_lexer(&stream->lexer, line, (size_t)length);
+    token->type = TOKEN_NEWLINE;
+    token->text = NULL;
+    token->length = 0;
+    token->expand = 0;
+    return 0;
+}
 
-        if (open(result->output_file, flags, 0644) < 0) {
-            perror("open");
-            return -1;
+/*
+ * checks if a word is reserved for compound commands
+ */
+static int is_reserved(const char *word) {
+    static const char *const reserved[] = {
+        "if", "then", "elif", "else", "fi",   "while", "until",
+        "do", "done", "for",  "case", "esac", NULL};
+    for (int i = 0; reserved[i]; i++) {
+        if (strcmp(word, reserved[i]) == 0) {
+            return 1;
         }
     }
-
     return 0;
 }
 
 /*
- * handles execution of shell built-in commands
+ * checks if a word is a variable name
  *
- * result - pointer to parsed command info
- * returns 1 if command was handled, 0 if not a builtin, -1 on error
+ * word - word to check
+ * length - length of the name part of word
  */
-static int handle_builtin(struct parse_result *result) {
-    if (!result || !result->command_path || !result->argv[0]) {
-        return -1;
+static int is_name(const char *word, size_t length) {
+    if (length == 0 || !(isalpha((unsigned char)word[0]) || word[0] == '_')) {
+        return 0;
     }
+    for (size_t i = 1; i < length; i++) {
+        if (!(isalnum((unsigned char)word[i]) || word[i] == '_')) {
+            return 0;
+        }
+    }
+    return 1;
+}
 
-    // handle fg/bg commands
-    if (result->cmd_type == CMD_FG || result->cmd_type == CMD_BG) {
-        pid_t pid;
-        process_state_t state;
+/*
+ * checks if a word is an assignment of the form NAME=value
+ */
+static int is_assignment(const char *word) {
+    const char *equals = strchr(word, '=');
+    return equals && is_name(word, (size_t)(equals - word));
+}
 
-        // validate job existence
-        if (get_job_info(result->job_id, &pid, &state) < 0) {
-            fprintf(stderr, "ERROR: No such job\n");
+/*
+ * appends an argument to argv, doubling its capacity as needed
+ * the expand flags are allocated alongside argv once an argument needs them
+ *
+ * arena - arena that argv was allocated from
+ * result - pointer to parse result whose argv is grown
+ * count - pointer to number of args so far
+ * capacity - pointer to current capacity of argv
+ * arg - argument to append
+ * expand - 1 if arg is kept as written for expansion at run time
+ * returns 0 on success, -1 on allocation failure
+ */
+static int push_arg(arena_t *arena, struct parse_result *result,
+                    size_t *count, size_t *capacity, char *arg, int expand) {
+    if (*count + 1 >= *capacity) {
+        char **argv = arena_grow(arena, result->argv,
+                                 *capacity * sizeof(char *),
+                                 2 * *capacity * sizeof(char *));
+        if (!argv) {
+            fprintf(stderr, "ERROR: Out of memory\n");
             return -1;
         }
+        result->argv = argv;
 
-        if (result->cmd_type == CMD_FG) {
-            // move to fg
-            if (give_terminal_to(pid) < 0 ||
-                send_signal_to_job(pid, SIGCONT) < 0) {
-                take_terminal_control();
+        if (result->expand_argv) {
+            unsigned char *flags = arena_grow(arena, result->expand_argv,
+                                              *capacity, 2 * *capacity);
+            if (!flags) {
+                fprintf(stderr, "ERROR: Out of memory\n");
                 return -1;
             }
+            result->expand_argv = flags;
+        }
+        *capacity *= 2;
+    }
 
-            fg_pid = pid;
-            foreground_job_id = result->job_id;
-            update_job_pid(job_list, pid, RUNNING);
+    if (expand && !result->expand_argv) {
+        result->expand_argv = arena_alloc(arena, *capacity);
+        if (!result->expand_argv) {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            return -1;
+        }
+        memset(result->expand_argv, 0, *capacity);
+    }
+    if (result->expand_argv) {
+        result->expand_argv[*count] = (unsigned char)expand;
+    }
+    result->argv[(*count)++] = arg;
+    return 0;
+}
 
-            int status;
-            int wait_result = wait_for_job(pid, &status);
+/*
+ * appends a redirection to the end of a command's list
+ *
+ * arena - arena to allocate the redirection from
+ * result - command to add the redirection to
+ * type - kind of redirection
+ * fd - fd the redirection changes
+ * target - fd to copy for REDIRECT_DUP
+ * word - file word for redirections that open one, NULL otherwise
+ * returns 0 on success, -1 on allocation failure
+ */
+static int push_redirect(arena_t *arena, struct parse_result *result,
+                         redirect_type_t type, int fd, int target,
+                         const token_t *word) {
+    redirect_t *redirect = arena_alloc(arena, sizeof(redirect_t));
+    if (!redirect) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return -1;
+    }
+    redirect->type = type;
+    redirect->fd = fd;
+    redirect->target = target;
+    redirect->file = word ? word->text : NULL;
+    redirect->expand = word ? word->expand : 0;
+    redirect->next = NULL;
+    if (redirect->expand) {
+        result->expand_redirects = 1;
+    }
+
+    redirect_t **tail = &result->redirects;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = redirect;
+    return 0;
+}
+
+/*
+ * adds the redirection an operator and the word after it write
+ * <& and >& take an fd number to copy, or - to close the fd, and &>file
+ * sends both stdout and stderr to file
+ *
+ * arena - arena to allocate the redirection from
+ * result - command to add the redirection to
+ * type - redirection operator
+ * fd - fd written right before the operator, -1 for its default
+ * word - word after the operator
+ * returns 0 on success, -1 on error
+ */
+static int parse_redirect(arena_t *arena, struct parse_result *result,
+                          token_type_t type, int fd, const token_t *word) {
+    int input = type == TOKEN_INPUT || type == TOKEN_READ_WRITE ||
+                type == TOKEN_DUP_INPUT;
+    if (fd < 0) {
+        fd = input ? STDIN_FILENO : STDOUT_FILENO;
+    }
 
-            if (wait_result < 0) {
-                take_terminal_control();
+    switch (type) {
+        case TOKEN_INPUT:
+            return push_redirect(arena, result, REDIRECT_INPUT, fd, -1, word);
+        case TOKEN_OUTPUT:
+            return push_redirect(arena, result, REDIRECT_OUTPUT, fd, -1, word);
+        case TOKEN_APPEND:
+            return push_redirect(arena, result, REDIRECT_APPEND, fd, -1, word);
+        case TOKEN_READ_WRITE:
+            return push_redirect(arena, result, REDIRECT_READ_WRITE, fd, -1,
+                                 word);
+        case TOKEN_OUTPUT_ALL:
+            if (push_redirect(arena, result, REDIRECT_OUTPUT, STDOUT_FILENO,
+                              -1, word) < 0) {
                 return -1;
             }
+            return push_redirect(arena, result, REDIRECT_DUP, STDERR_FILENO,
+                                 STDOUT_FILENO, NULL);
+        default:
+            break;
+    }
 
-            // handle status change for job
-            if (wait_result == 1 && WIFSTOPPED(status)) {
-                fprintf(stdout, "[%d] (%d) suspended by signal %d\n",
-                        result->job_id, pid, WSTOPSIG(status));
-                update_job_pid(job_list, pid, STOPPED);
-            } else if (WIFSIGNALED(status)) {
-                fprintf(stdout, "(%d) terminated by signal %d\n", pid,
-                        WTERMSIG(status));
-                remove_job_jid(job_list, result->job_id);
-            } else {
-                remove_job_jid(job_list, result->job_id);
-            }
+    if (!word->expand && strcmp(word->text, "-") == 0) {
+        return push_redirect(arena, result, REDIRECT_CLOSE, fd, -1, NULL);
+    }
+    char *end;
+    errno = 0;
+    long target = strtol(word->text, &end, 10);
+    if (word->expand || !isdigit((unsigned char)word->text[0]) ||
+        *end != '\0' || errno || target > INT_MAX) {
+        fprintf(stderr, "ERROR: Invalid file descriptor %s\n", word->text);
+        return -1;
+    }
+    return push_redirect(arena, result, REDIRECT_DUP, fd, (int)target, NULL);
+}
 
-            fg_pid = -1;
-            foreground_job_id = -1;
+static const struct builtin *find_builtin(const char *name, size_t length);
 
-            return take_terminal_control() == 0 ? 1 : -1;
-        } else {  // bg
-            if (state != STOPPED) {
-                fprintf(stderr, "ERROR: Job is already running\n");
-                return -1;
-            }
+/*
+ * checks if a token ends a command in a list
+ */
+static int is_separator(token_type_t type) {
+    return type == TOKEN_END || type == TOKEN_SEMICOLON || type == TOKEN_AND ||
+           type == TOKEN_OR || type == TOKEN_PIPE ||
+           type == TOKEN_BACKGROUND || type == TOKEN_NEWLINE ||
+           type == TOKEN_DOUBLE_SEMICOLON || type == TOKEN_OPEN_PAREN ||
+           type == TOKEN_CLOSE_PAREN;
+}
 
-            if (send_signal_to_job(pid, SIGCONT) < 0) {
-                return -1;
-            }
+/*
+ * checks if a token type is a redirection operator
+ */
+static int is_redirection(token_type_t type) {
+    return type == TOKEN_INPUT || type == TOKEN_OUTPUT ||
+           type == TOKEN_APPEND || type == TOKEN_READ_WRITE ||
+           type == TOKEN_DUP_INPUT || type == TOKEN_DUP_OUTPUT ||
+           type == TOKEN_OUTPUT_ALL;
+}
 
-            update_job_pid(job_list, pid, RUNNING);
-            return 1;
-        }
-    }
+/*
+ * checks if a token is a reserved word, which is never kept for expansion
+ */
+static int is_reserved_token(const token_t *token) {
+    return token->type == TOKEN_WORD && !token->expand &&
+           is_reserved(token->text);
+}
 
-    // skips built-in handling for paths containing '/'
-    if (strchr(result->command_path, '/')) {
-        return 0;
+/*
+ * prints a syntax error for a token that cannot appear where it is
+ */
+static void report_unexpected(const token_t *token) {
+    static const char *const names[] = {
+        [TOKEN_INPUT] = "<",      [TOKEN_OUTPUT] = ">",
+        [TOKEN_APPEND] = ">>",    [TOKEN_READ_WRITE] = "<>",
+        [TOKEN_DUP_INPUT] = "<&", [TOKEN_DUP_OUTPUT] = ">&",
+        [TOKEN_OUTPUT_ALL] = "&>", [TOKEN_BACKGROUND] = "&",
+        [TOKEN_SEMICOLON] = ";",  [TOKEN_AND] = "&&",
+        [TOKEN_OR] = "||",        [TOKEN_PIPE] = "|",
+        [TOKEN_DOUBLE_SEMICOLON] = ";;",
+        [TOKEN_OPEN_PAREN] = "(", [TOKEN_CLOSE_PAREN] = ")"};
+
+    if (token->type == TOKEN_WORD) {
+        fprintf(stderr, "ERROR: Unexpected %s\n", token->text);
+    } else if (token->type == TOKEN_END || token->type == TOKEN_NEWLINE) {
+        fprintf(stderr, "ERROR: Unexpected end of input\n");
+    } else {
+        fprintf(stderr, "ERROR: Unexpected %s\n", names[token->type]);
     }
+}
 
-    // handle other built-in commands
-    if (strcmp(result->argv[0], "exit") == 0) {
-        if (result->argv[1]) {
-            fprintf(stderr, "ERROR: exit command takes no arguments\n");
-            return -1;
-        }
-        cleanup_job_list(job_list);
-        exit(0);
+/*
+ * parses one command of a list into result
+ * handles command parsing, I/O redirection, background process and job
+ * control commands
+ *
+ * stream - token stream positioned after token
+ * token - first token of the command; holds the separator that ended the
+ *         command on return
+ * result - pointer to structure to store parsed command information
+ * arena - arena to allocate argv from
+ * returns 0 on success, PARSE_COMPOUND if token is a reserved word, -1 on
+ * parsing error
+ */
+static int parse_command(struct token_stream *stream, token_t *token,
+                         struct parse_result *result, arena_t *arena) {
+    size_t arg_count = 0;
+    size_t arg_capacity = INITIAL_ARGS;
+
+    if (is_reserved_token(token)) {
+        return PARSE_COMPOUND;
     }
 
-    if (strcmp(result->argv[0], "jobs") == 0) {
-        jobs(job_list);
-        return 1;
+    result->argv = arena_alloc(arena, arg_capacity * sizeof(char *));
+    if (!result->argv) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return -1;
     }
 
-    if (strcmp(result->argv[0], "cd") == 0) {
-        if (!result->argv[1]) {
-            fprintf(stderr, "ERROR: cd requires a directory argument\n");
+    // handle job control commands
+    const struct builtin *builtin =
+        token->type == TOKEN_WORD ? find_builtin(token->text, token->length)
+                                  : NULL;
+    if (builtin && (builtin->flags & BUILTIN_JOB)) {
+        result->builtin = builtin;
+        result->command_path = token->text;
+        if (read_token(stream, token) < 0) {
             return -1;
         }
-        if (result->argv[2]) {
-            fprintf(stderr, "ERROR: cd takes only one argument\n");
+
+        if (token->type != TOKEN_WORD || token->text[0] != '%') {
+            fprintf(stderr, "ERROR: Expected %%<job-id>\n");
             return -1;
         }
-        if (chdir(result->argv[1]) < 0) {
-            perror("cd");
+
+        char *job_str = token->text + 1;
+        if (!isdigit((unsigned char)*job_str)) {
+            fprintf(stderr, "ERROR: Invalid job ID\n");
             return -1;
         }
-        return 1;
-    }
 
-    if (strcmp(result->argv[0], "ln") == 0) {
-        if (!result->argv[1] || !result->argv[2]) {
-            fprintf(stderr,
-                    "ERROR: ln requires source and destination arguments\n");
+        result->job_id = atoi(job_str);
+        result->argv[0] = result->command_path;
+        result->argv[1] = NULL;
+
+        // check for extra args
+        if (read_token(stream, token) < 0) {
             return -1;
         }
-        if (result->argv[3]) {
-            fprintf(stderr, "ERROR: ln takes exactly two arguments\n");
+        if (!is_separator(token->type) || token->type == TOKEN_BACKGROUND) {
+            fprintf(stderr, "ERROR: Too many arguments\n");
             return -1;
         }
-        if (link(result->argv[1], result->argv[2]) < 0) {
-            perror("ln");
+
+        return 0;
+    }
+
+    // process command, args and redirections up to the separator
+    while (!is_separator(token->type)) {
+        token_type_t type = token->type;
+
+        // handle redirections, which apply in the order written
+        if (is_redirection(type)) {
+            int fd = token->fd;
+            if (read_token(stream, token) < 0) {
+                return -1;
+            }
+            if (token->type != TOKEN_WORD) {
+                fprintf(stderr, "ERROR: Invalid redirection\n");
+                return -1;
+            }
+            if (parse_redirect(arena, result, type, fd, token) < 0) {
+                return -1;
+            }
+        } else if (!result->command_path) {
+            // handle command, extracting command name from path for argv[0]
+            // an assignment keeps the whole word
+            result->command_path = token->text;
+            char *last_slash = strrchr(token->text, '/');
+            if (is_assignment(token->text)) {
+                result->cmd_type = CMD_ASSIGN;
+                last_slash = NULL;
+            } else if (!last_slash && !token->expand) {
+                result->builtin = find_builtin(token->text, token->length);
+            }
+            if (push_arg(arena, result, &arg_count, &arg_capacity,
+                         last_slash ? last_slash + 1 : token->text,
+                         token->expand) < 0) {
+                return -1;
+            }
+        } else if (push_arg(arena, result, &arg_count, &arg_capacity,
+                            token->text, token->expand) < 0) {
+            return -1;
+        }
+
+        if (read_token(stream, token) < 0) {
+            return -1;
+        }
+    }
+
+    // validate command
+    if (!result->command_path) {
+        fprintf(stderr, "ERROR: No command specified\n");
+        return -1;
+    }
+    if (result->cmd_type == CMD_ASSIGN && arg_count > 1) {
+        fprintf(stderr,
+                "ERROR: Assignments before a command are not supported\n");
+        return -1;
+    }
+
+    result->background = (token->type == TOKEN_BACKGROUND);
+    result->argv[arg_count] = NULL;
+    return 0;
+}
+
+/*
+ * initializes a parse result to an empty command
+ *
+ * op - how the command is joined to the one before it
+ */
+static void init_parse_result(struct parse_result *result, enum list_op op) {
+    result->command_path = NULL;
+    result->redirects = NULL;
+    result->argv = NULL;
+    result->expand_argv = NULL;
+    result->expand_redirects = 0;
+    result->background = 0;
+    result->cmd_type = CMD_REGULAR;
+    result->builtin = NULL;
+    result->job_id = -1;
+    result->op = op;
+    result->next = NULL;
+}
+
+/*
+ * parses commands joined by ;, &, &&, || and | into a list
+ * the commands of a pipeline are joined with LIST_PIPE, and & after the
+ * last one puts the whole pipeline in the background
+ * the list ends at the end of the line, at a newline, ;; or parenthesis,
+ * or at a reserved word after ; or &
+ *
+ * stream - token stream positioned after token
+ * token - first token of the list; holds the token that ended the list on
+ *         return
+ * result - pointer to store the first command; later commands are linked
+ *          through next
+ * arena - arena to allocate argv and later commands from
+ * returns 0 on success, PARSE_COMPOUND if the list starts with a reserved
+ * word, -1 on parsing error
+ */
+static int parse_list(struct token_stream *stream, token_t *token,
+                      struct parse_result *result, arena_t *arena) {
+    struct parse_result *command = result;
+    struct parse_result *pipeline = result;  // first command of the pipeline
+    enum list_op op = LIST_SEQ;
+
+    init_parse_result(result, LIST_SEQ);
+    while (1) {
+        if (is_separator(token->type)) {
+            if (op == LIST_SEQ) {
+                fprintf(stderr, "ERROR: Expected command before operator\n");
+            } else {
+                fprintf(stderr, "ERROR: Expected command after operator\n");
+            }
+            return -1;
+        }
+        if (command != result) {
+            init_parse_result(command, op);
+            if (op != LIST_PIPE) {
+                pipeline = command;
+            }
+        }
+
+        int status = parse_command(stream, token, command, arena);
+        if (status < 0) {
+            return -1;
+        }
+        if (status == PARSE_COMPOUND) {
+            if (command == result) {
+                return PARSE_COMPOUND;
+            }
+            fprintf(stderr, "ERROR: Compound commands in &&, || and | "
+                            "lists are not supported\n");
+            return -1;
+        }
+
+        // work out how the next command is joined to this one
+        switch (token->type) {
+            case TOKEN_AND:
+                op = LIST_AND;
+                break;
+            case TOKEN_OR:
+                op = LIST_OR;
+                break;
+            case TOKEN_PIPE:
+                op = LIST_PIPE;
+                break;
+            case TOKEN_BACKGROUND:
+                for (; pipeline != command; pipeline = pipeline->next) {
+                    pipeline->background = 1;
+                }
+                op = LIST_SEQ;
+                break;
+            case TOKEN_SEMICOLON:
+                op = LIST_SEQ;
+                break;
+            default:
+                return 0;
+        }
+
+        if (read_token(stream, token) < 0) {
+            return -1;
+        }
+        if (op == LIST_SEQ) {
+            if (token->type == TOKEN_END || token->type == TOKEN_NEWLINE ||
+                token->type == TOKEN_DOUBLE_SEMICOLON ||
+                is_reserved_token(token)) {
+                return 0;
+            }
+        } else {
+            // &&, || and | carry on to the next line
+            while (token->type == TOKEN_NEWLINE) {
+                if (read_token(stream, token) < 0) {
+                    return -1;
+                }
+            }
+        }
+
+        command->next = arena_alloc(arena, sizeof(struct parse_result));
+        if (!command->next) {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            return -1;
+        }
+        command = command->next;
+    }
+}
+
+/*
+ * parses a line into a list of commands joined by ;, &, &&, || and |
+ * words are read in a single pass by the lexer and stay in the buffer
+ *
+ * buffer - input string to be parsed, modified in place
+ * length - length of buffer, buffer[length] must be writable
+ * result - pointer to store the first command; later commands are linked
+ *          through next
+ * arena - arena to allocate argv and later commands from
+ * returns 0 on success, 1 if the line is empty, PARSE_COMPOUND if the line
+ * has a compound command, -1 on parsing error
+ */
+static int parse(char *buffer, size_t length, struct parse_result *result,
+                 arena_t *arena) {
+    if (!buffer || !result) {
+        return -1;
+    }
+
+    struct token_stream stream = {.source = NULL, .arena = arena, .depth = 0};
+    token_t token;
+
+    init_lexer(&stream.lexer, buffer, length);
+    if (read_token(&stream, &token) < 0) {
+        return -1;
+    }
+    if (token.type == TOKEN_END) {
+        return 1;
+    }
+
+    int status = parse_list(&stream, &token, result, arena);
+    if (status != 0) {
+        return status;
+    }
+    if (is_reserved_token(&token)) {
+        return PARSE_COMPOUND;
+    }
+    if (token.type != TOKEN_END) {
+        report_unexpected(&token);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * hashes a raw input line 8 bytes at a time
+ *
+ * line - line to hash
+ * length - length of line in bytes
+ * returns 64-bit hash of line
+ */
+static uint64_t hash_line(const char *line, size_t length) {
+    const uint64_t multiplier = 0x9e3779b97f4a7c15ULL;
+    uint64_t hash = length * multiplier;
+    uint64_t word;
+
+    while (length >= sizeof(word)) {
+        memcpy(&word, line, sizeof(word));
+        hash = (hash ^ word) * multiplier;
+        hash ^= hash >> 29;
+        line += sizeof(word);
+        length -= sizeof(word);
+    }
+
+    word = 0;
+    memcpy(&word, line, length);
+    hash = (hash ^ word) * multiplier;
+    return hash ^ (hash >> 32);
+}
+
+/*
+ * parses a copy of a line into command_arena, leaving the line itself as
+ * written for the compiler in case it holds a compound command
+ *
+ * returns status of parse
+ */
+static int parse_uncached(const char *line, size_t length,
+                          struct parse_result *result) {
+    char *copy = arena_alloc(command_arena, length + 1);
+    if (!copy) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return -1;
+    }
+    memcpy(copy, line, length + 1);
+    return parse(copy, length, result, command_arena);
+}
+
+/*
+ * parses a line through the parse cache
+ * on a hit the stored result is returned without lexing the line; on a miss
+ * the line is copied into a spare arena and parsed there, and the arena
+ * replaces the slot's old one if parsing succeeds
+ * lines that are too long, or whose slot is in use by a line still running,
+ * are parsed into command_arena and not cached
+ * lines with compound commands are never cached
+ *
+ * line - raw null terminated input line, left as written
+ * length - length of line in bytes
+ * result - pointer to store parsed command information
+ * entry - pointer to store the cache entry that owns result, which stays
+ *         pinned until the caller unpins it, or NULL if result is not cached
+ * returns 0 on success, 1 if the line is empty, PARSE_COMPOUND if the line
+ * has a compound command, -1 on parsing error
+ */
+static int cached_parse(char *line, size_t length, struct parse_result *result,
+                        struct parse_cache_entry **entry) {
+    uint64_t hash = hash_line(line, length);
+    struct parse_cache_entry *slot = &parse_cache[hash % PARSE_CACHE_SIZE];
+    *entry = NULL;
+
+    if (slot->arena && slot->hash == hash && slot->length == length &&
+        memcmp(slot->line, line, length) == 0) {
+        parse_cache_hits++;
+        slot->in_use++;
+        *result = slot->result;
+        *entry = slot;
+        return 0;
+    }
+
+    parse_cache_misses++;
+    if (length > PARSE_CACHE_MAX_LINE || slot->in_use ||
+        (!parse_cache_spare &&
+         !(parse_cache_spare = init_arena(PARSE_CACHE_CHUNK_SIZE)))) {
+        return parse_uncached(line, length, result);
+    }
+
+    // parse a private copy so the raw line can still be compared later
+    arena_t *arena = parse_cache_spare;
+    arena_reset(arena);
+    char *copy = arena_alloc(arena, 2 * (length + 1));
+    if (!copy) {
+        return parse_uncached(line, length, result);
+    }
+    memcpy(copy, line, length);
+    copy[length] = '\0';
+    char *words = copy + length + 1;
+    memcpy(words, line, length + 1);
+
+    int status = parse(words, length, result, arena);
+    if (status != 0) {
+        return status;
+    }
+
+    parse_cache_spare = slot->arena;
+    slot->arena = arena;
+    slot->hash = hash;
+    slot->length = length;
+    slot->line = copy;
+    slot->result = *result;
+    slot->in_use = 1;
+    *entry = slot;
+    return 0;
+}
+
+/*
+ * appends an instruction to the program being compiled
+ *
+ * op - opcode of the instruction
+ * operand - command list, for_loop or case_item, NULL if none
+ * returns index of the instruction, -1 on allocation failure
+ */
+static ssize_t emit(struct compiler *compiler, enum opcode op, void *operand) {
+    if (compiler->count == compiler->capacity) {
+        size_t capacity = compiler->capacity ? 2 * compiler->capacity
+                                             : INITIAL_CODE;
+        struct instruction *code =
+            arena_grow(compiler->stream.arena, compiler->code,
+                       compiler->capacity * sizeof(struct instruction),
+                       capacity * sizeof(struct instruction));
+        if (!code) {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            return -1;
+        }
+        compiler->code = code;
+        compiler->capacity = capacity;
+    }
+
+    struct instruction *instruction = &compiler->code[compiler->count];
+    instruction->op = op;
+    instruction->target = 0;
+    instruction->operand = operand;
+    instruction->loop = compiler->loop;
+    return (ssize_t)compiler->count++;
+}
+
+/*
+ * appends a word to a word list, doubling its capacity as needed
+ *
+ * arena - arena the list is allocated from
+ * word - word to append
+ * expand - 1 if word is kept as written
+ * returns 0 on success, -1 on allocation failure
+ */
+static int push_word(arena_t *arena, struct word_list *list, char *word,
+                     int expand) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? 2 * list->capacity : INITIAL_WORDS;
+        char **words = arena_grow(arena, list->words,
+                                  list->capacity * sizeof(char *),
+                                  capacity * sizeof(char *));
+        unsigned char *flags =
+            words ? arena_grow(arena, list->expand, list->capacity, capacity)
+                  : NULL;
+        if (!flags) {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            return -1;
+        }
+        list->words = words;
+        list->expand = flags;
+        list->capacity = capacity;
+    }
+
+    list->words[list->count] = word;
+    list->expand[list->count] = (unsigned char)expand;
+    list->count++;
+    return 0;
+}
+
+/* moves the compiler to the next token, returns 0 or -1 on error */
+static int advance(struct compiler *compiler) {
+    return read_token(&compiler->stream, &compiler->token);
+}
+
+/* skips newlines between commands, returns 0 or -1 on error */
+static int skip_newlines(struct compiler *compiler) {
+    while (compiler->token.type == TOKEN_NEWLINE) {
+        if (advance(compiler) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* checks if the current token is the unquoted word given */
+static int at_keyword(const struct compiler *compiler, const char *word) {
+    return compiler->token.type == TOKEN_WORD && !compiler->token.expand &&
+           strcmp(compiler->token.text, word) == 0;
+}
+
+/*
+ * moves past a reserved word that must come next
+ *
+ * word - reserved word expected
+ * returns 0 on success, -1 if the current token is not word
+ */
+static int expect_keyword(struct compiler *compiler, const char *word) {
+    if (!at_keyword(compiler, word)) {
+        fprintf(stderr, "ERROR: Expected %s\n", word);
+        return -1;
+    }
+    return advance(compiler);
+}
+
+/*
+ * moves past the reserved word that closes a compound command
+ * the command is closed before the next token is read, so the line it
+ * ends on is not followed by a read of the next one
+ *
+ * word - closing reserved word
+ * returns 0 on success, -1 if the current token is not word
+ */
+static int close_compound(struct compiler *compiler, const char *word) {
+    if (!at_keyword(compiler, word)) {
+        fprintf(stderr, "ERROR: Expected %s\n", word);
+        return -1;
+    }
+    compiler->stream.depth--;
+    return advance(compiler);
+}
+
+/*
+ * sets the target of every jump in a chain linked through their targets
+ *
+ * jump - index of the last jump in the chain, -1 if none
+ * target - index to jump to
+ */
+static void patch_jumps(struct compiler *compiler, ssize_t jump,
+                        size_t target) {
+    while (jump >= 0) {
+        ssize_t previous = (ssize_t)compiler->code[jump].target - 1;
+        compiler->code[jump].target = target;
+        jump = previous;
+    }
+}
+
+/*
+ * adds a jump to a chain to be patched later
+ * targets in the chain hold the index of the previous jump plus one
+ *
+ * chain - pointer to index of the last jump in the chain, -1 if none
+ * returns 0 on success, -1 on allocation failure
+ */
+static int chain_jump(struct compiler *compiler, ssize_t *chain) {
+    ssize_t jump = emit(compiler, OP_JUMP, NULL);
+    if (jump < 0) {
+        return -1;
+    }
+    compiler->code[jump].target = (size_t)(*chain + 1);
+    *chain = jump;
+    return 0;
+}
+
+static int compile_list(struct compiler *compiler);
+
+/*
+ * compiles if list; then list; [elif list; then list;]... [else list;] fi
+ * returns 0 on success, -1 on error
+ */
+static int compile_if(struct compiler *compiler) {
+    ssize_t exits = -1;
+    compiler->stream.depth++;
+    if (advance(compiler) < 0) {
+        return -1;
+    }
+
+    while (1) {
+        if (compile_list(compiler) < 0 ||
+            expect_keyword(compiler, "then") < 0) {
+            return -1;
+        }
+        ssize_t skip = emit(compiler, OP_JUMP_FALSE, NULL);
+        if (skip < 0 || compile_list(compiler) < 0 ||
+            chain_jump(compiler, &exits) < 0) {
+            return -1;
+        }
+        compiler->code[skip].target = compiler->count;
+
+        if (!at_keyword(compiler, "elif")) {
+            break;
+        }
+        if (advance(compiler) < 0) {
+            return -1;
+        }
+    }
+
+    // without an else branch the if succeeds when no condition did
+    if (at_keyword(compiler, "else")) {
+        if (advance(compiler) < 0 || compile_list(compiler) < 0) {
+            return -1;
+        }
+    } else if (emit(compiler, OP_TRUE, NULL) < 0) {
+        return -1;
+    }
+
+    patch_jumps(compiler, exits, compiler->count);
+    return close_compound(compiler, "fi");
+}
+
+/*
+ * compiles while list; do list; done and until list; do list; done
+ *
+ * until - 1 for until, which loops while the condition fails
+ * returns 0 on success, -1 on error
+ */
+static int compile_while(struct compiler *compiler, int until) {
+    struct loop_targets *outer = compiler->loop;
+    struct loop_targets *loop =
+        arena_alloc(compiler->stream.arena, sizeof(struct loop_targets));
+    if (!loop) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return -1;
+    }
+    compiler->stream.depth++;
+    if (advance(compiler) < 0) {
+        return -1;
+    }
+
+    compiler->loop = loop;
+    loop->next = compiler->count;
+    if (compile_list(compiler) < 0 || expect_keyword(compiler, "do") < 0) {
+        return -1;
+    }
+    ssize_t exit = emit(compiler, until ? OP_JUMP_TRUE : OP_JUMP_FALSE, NULL);
+    if (exit < 0 || compile_list(compiler) < 0) {
+        return -1;
+    }
+    ssize_t back = emit(compiler, OP_JUMP, NULL);
+    if (back < 0) {
+        return -1;
+    }
+    compiler->code[back].target = loop->next;
+    compiler->loop = outer;
+
+    // the loop ends with status 0, whether by its condition or by break
+    loop->exit = compiler->count;
+    compiler->code[exit].target = loop->exit;
+    if (emit(compiler, OP_TRUE, NULL) < 0) {
+        return -1;
+    }
+    return close_compound(compiler, "done");
+}
+
+/*
+ * compiles for name in word...; do list; done
+ * returns 0 on success, -1 on error
+ */
+static int compile_for(struct compiler *compiler) {
+    arena_t *arena = compiler->stream.arena;
+    struct loop_targets *outer = compiler->loop;
+    struct loop_targets *loop = arena_alloc(arena, sizeof(struct loop_targets));
+    struct for_loop *for_loop = arena_alloc(arena, sizeof(struct for_loop));
+    if (!loop || !for_loop) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return -1;
+    }
+    compiler->stream.depth++;
+    if (advance(compiler) < 0) {
+        return -1;
+    }
+
+    token_t *token = &compiler->token;
+    if (token->type != TOKEN_WORD || token->expand ||
+        !is_name(token->text, token->length)) {
+        fprintf(stderr, "ERROR: Invalid for loop variable\n");
+        return -1;
+    }
+    for_loop->name = token->text;
+    for_loop->list = (struct word_list){NULL, NULL, 0, 0};
+    if (advance(compiler) < 0 || expect_keyword(compiler, "in") < 0) {
+        return -1;
+    }
+
+    // words up to the end of the line or ;
+    while (token->type == TOKEN_WORD) {
+        if (push_word(arena, &for_loop->list, token->text, token->expand) < 0 ||
+            advance(compiler) < 0) {
+            return -1;
+        }
+    }
+    if (token->type != TOKEN_SEMICOLON && token->type != TOKEN_NEWLINE) {
+        report_unexpected(token);
+        return -1;
+    }
+    if (advance(compiler) < 0 || skip_newlines(compiler) < 0 ||
+        expect_keyword(compiler, "do") < 0) {
+        return -1;
+    }
+
+    if (emit(compiler, OP_FOR_INIT, for_loop) < 0) {
+        return -1;
+    }
+    ssize_t next = emit(compiler, OP_FOR_NEXT, for_loop);
+    if (next < 0) {
+        return -1;
+    }
+    compiler->loop = loop;
+    if (compile_list(compiler) < 0) {
+        return -1;
+    }
+    ssize_t back = emit(compiler, OP_JUMP, NULL);
+    if (back < 0) {
+        return -1;
+    }
+    compiler->code[back].target = (size_t)next;
+    compiler->loop = outer;
+
+    loop->next = (size_t)next;
+    loop->exit = compiler->count;
+    compiler->code[next].target = loop->exit;
+    return close_compound(compiler, "done");
+}
+
+/*
+ * reads the patterns of a case item up to its )
+ * patterns written together as a|b are split apart
+ *
+ * item - case item to add patterns to
+ * returns 0 on success, -1 on error
+ */
+static int compile_patterns(struct compiler *compiler,
+                            struct case_item *item) {
+    arena_t *arena = compiler->stream.arena;
+    token_t *token = &compiler->token;
+
+    if (token->type == TOKEN_OPEN_PAREN && advance(compiler) < 0) {
+        return -1;
+    }
+    while (token->type == TOKEN_WORD) {
+        if (token->expand) {
+            if (push_word(arena, &item->patterns, token->text, 1) < 0) {
+                return -1;
+            }
+        } else {
+            char *pattern = token->text;
+            while (pattern) {
+                char *bar = strchr(pattern, '|');
+                if (bar) {
+                    *bar = '\0';
+                }
+                if (*pattern &&
+                    push_word(arena, &item->patterns, pattern, 0) < 0) {
+                    return -1;
+                }
+                pattern = bar ? bar + 1 : NULL;
+            }
+        }
+        if (advance(compiler) < 0) {
+            return -1;
+        }
+    }
+
+    if (token->type != TOKEN_CLOSE_PAREN || item->patterns.count == 0) {
+        fprintf(stderr, "ERROR: Expected pattern)\n");
+        return -1;
+    }
+    return advance(compiler);
+}
+
+/*
+ * compiles case word in [pattern) list ;;]... esac
+ * returns 0 on success, -1 on error
+ */
+static int compile_case(struct compiler *compiler) {
+    token_t *token = &compiler->token;
+    ssize_t exits = -1;
+
+    compiler->stream.depth++;
+    if (advance(compiler) < 0) {
+        return -1;
+    }
+    if (token->type != TOKEN_WORD) {
+        report_unexpected(token);
+        return -1;
+    }
+    char *word = token->text;
+    int expand = token->expand;
+    if (advance(compiler) < 0 || expect_keyword(compiler, "in") < 0) {
+        return -1;
+    }
+
+    // a case with no matching item succeeds
+    if (emit(compiler, OP_TRUE, NULL) < 0) {
+        return -1;
+    }
+
+    while (1) {
+        if (skip_newlines(compiler) < 0) {
+            return -1;
+        }
+        if (at_keyword(compiler, "esac")) {
+            break;
+        }
+
+        struct case_item *item =
+            arena_alloc(compiler->stream.arena, sizeof(struct case_item));
+        if (!item) {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            return -1;
+        }
+        item->word = word;
+        item->expand = expand;
+        item->patterns = (struct word_list){NULL, NULL, 0, 0};
+        if (compile_patterns(compiler, item) < 0) {
+            return -1;
+        }
+
+        ssize_t skip = emit(compiler, OP_MATCH, item);
+        if (skip < 0 || compile_list(compiler) < 0 ||
+            chain_jump(compiler, &exits) < 0) {
+            return -1;
+        }
+        compiler->code[skip].target = compiler->count;
+
+        if (token->type == TOKEN_DOUBLE_SEMICOLON) {
+            if (advance(compiler) < 0) {
+                return -1;
+            }
+        } else if (!at_keyword(compiler, "esac")) {
+            report_unexpected(token);
+            return -1;
+        }
+    }
+
+    patch_jumps(compiler, exits, compiler->count);
+    return close_compound(compiler, "esac");
+}
+
+/*
+ * compiles commands and compound commands up to a reserved word that does
+ * not start one, ;; or the end of input; the caller checks what ended it
+ *
+ * returns 0 on success, -1 on error
+ */
+static int compile_list(struct compiler *compiler) {
+    token_t *token = &compiler->token;
+
+    while (1) {
+        if (skip_newlines(compiler) < 0) {
+            return -1;
+        }
+        if (token->type == TOKEN_END ||
+            token->type == TOKEN_DOUBLE_SEMICOLON) {
+            return 0;
+        }
+
+        if (is_reserved_token(token)) {
+            int status;
+            if (strcmp(token->text, "if") == 0) {
+                status = compile_if(compiler);
+            } else if (strcmp(token->text, "while") == 0) {
+                status = compile_while(compiler, 0);
+            } else if (strcmp(token->text, "until") == 0) {
+                status = compile_while(compiler, 1);
+            } else if (strcmp(token->text, "for") == 0) {
+                status = compile_for(compiler);
+            } else if (strcmp(token->text, "case") == 0) {
+                status = compile_case(compiler);
+            } else {
+                return 0;
+            }
+            if (status < 0) {
+                return -1;
+            }
+
+            // a compound command is followed by a separator or a reserved
+            // word that closes the one around it
+            if (token->type == TOKEN_SEMICOLON) {
+                if (advance(compiler) < 0) {
+                    return -1;
+                }
+            } else if (is_redirection(token->type)) {
+                fprintf(stderr, "ERROR: Redirections on compound commands "
+                                "are not supported\n");
+                return -1;
+            } else if (token->type != TOKEN_END &&
+                       token->type != TOKEN_NEWLINE &&
+                       token->type != TOKEN_DOUBLE_SEMICOLON &&
+                       !is_reserved_token(token)) {
+                report_unexpected(token);
+                return -1;
+            }
+            continue;
+        }
+
+        if (token->type != TOKEN_WORD && !is_redirection(token->type)) {
+            report_unexpected(token);
+            return -1;
+        }
+
+        // a plain command list runs as one instruction
+        struct parse_result *list =
+            arena_alloc(compiler->stream.arena, sizeof(struct parse_result));
+        if (!list) {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            return -1;
+        }
+        if (parse_list(&compiler->stream, token, list,
+                       compiler->stream.arena) != 0 ||
+            emit(compiler, OP_RUN, list) < 0) {
+            return -1;
+        }
+        if (token->type == TOKEN_OPEN_PAREN ||
+            token->type == TOKEN_CLOSE_PAREN) {
+            report_unexpected(token);
+            return -1;
+        }
+    }
+}
+
+/*
+ * compiles a line holding compound commands into a program
+ * lines are read from source until every compound command is closed; the
+ * program and its words are allocated from command_arena
+ *
+ * compiler - pointer to store the program in
+ * line - null terminated line that starts the program
+ * length - length of line in bytes
+ * source - source to read more lines from
+ * returns 0 on success, -1 on error
+ */
+static int compile(struct compiler *compiler, const char *line, size_t length,
+                   struct line_source *source) {
+    char *copy = arena_alloc(command_arena, length + 1);
+    if (!copy) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return -1;
+    }
+    memcpy(copy, line, length + 1);
+
+    compiler->stream.source = source;
+    compiler->stream.arena = command_arena;
+    compiler->stream.depth = 0;
+    compiler->code = NULL;
+    compiler->count = 0;
+    compiler->capacity = 0;
+    compiler->loop = NULL;
+    init_lexer(&compiler->stream.lexer, copy, length);
+
+    if (advance(compiler) < 0 || compile_list(compiler) < 0) {
+        return -1;
+    }
+    if (compiler->token.type != TOKEN_END) {
+        report_unexpected(&compiler->token);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * frees every arena owned by the parse cache
+ */
+static void cleanup_parse_cache(void) {
+    for (int i = 0; i < PARSE_CACHE_SIZE; i++) {
+        cleanup_arena(parse_cache[i].arena);
+        parse_cache[i].arena = NULL;
+    }
+    cleanup_arena(parse_cache_spare);
+    parse_cache_spare = NULL;
+}
+
+/*
+ * frees the shell's global state before it exits
+ */
+static void cleanup_shell(void) {
+    cleanup_parse_cache();
+    cleanup_vars();
+    cleanup_path_cache(path_cache);
+    cleanup_arena(command_arena);
+    cleanup_job_list(job_list);
+}
+
+/*
+ * gets the lowest latency counted in a launch latency bucket
+ *
+ * bucket - index of bucket, up to LAUNCH_BUCKETS
+ * returns lower bound in microseconds
+ */
+static unsigned long bucket_floor(int bucket) {
+    if (bucket < 4) {
+        return (unsigned long)bucket;
+    }
+    int shift = bucket / 4 - 1;
+    return (unsigned long)(4 + bucket % 4) << shift;
+}
+
+/*
+ * counts a launch in the latency histogram
+ *
+ * start - time the launch began
+ * end - time the command had been exec'd
+ */
+static void record_launch(const struct timespec *start,
+                          const struct timespec *end) {
+    long nanoseconds = (end->tv_sec - start->tv_sec) * 1000000000L +
+                       (end->tv_nsec - start->tv_nsec);
+    unsigned long micros = nanoseconds > 0 ? (unsigned long)nanoseconds / 1000
+                                           : 0;
+
+    int bucket = 0;
+    while (bucket + 1 < LAUNCH_BUCKETS && bucket_floor(bucket + 1) <= micros) {
+        bucket++;
+    }
+    launch_latency[bucket]++;
+    launch_count++;
+}
+
+/*
+ * prints launch latency percentiles as the upper bound of the bucket each
+ * falls in
+ */
+static void print_launch_latency(void) {
+    const int percentiles[] = {50, 90, 99};
+
+    printf("launches: %lu", launch_count);
+    for (int i = 0; i < 3 && launch_count > 0; i++) {
+        // the percentile is the first bucket where the running count
+        // reaches that share of all launches
+        unsigned long rank = (launch_count * (unsigned long)percentiles[i] +
+                              99) / 100;
+        unsigned long seen = 0;
+        int bucket = 0;
+        while ((seen += launch_latency[bucket]) < rank) {
+            bucket++;
+        }
+        printf(", p%d < %lu us", percentiles[i],
+               bucket + 1 < LAUNCH_BUCKETS ? bucket_floor(bucket + 1)
+                                           : bucket_floor(bucket));
+    }
+    printf("\n");
+}
+
+/*
+ * finds the full path of a command
+ * names without a slash are looked up in PATH through the command cache
+ *
+ * name - command name or path
+ * returns full path, NULL if the command was not found
+ */
+static const char *resolve_command(const char *name) {
+    if (strchr(name, '/')) {
+        return name;
+    }
+    const char *path = ensure_path_cache() ? find_command(path_cache, name)
+                                           : NULL;
+    if (!path) {
+        fprintf(stderr, "ERROR: %s: command not found\n", name);
+    }
+    return path;
+}
+
+/*
+ * replaces the shell with a command
+ * redirections are applied to the shell's own fds first, and the signals
+ * the shell ignores for job control get their default handlers back, since
+ * ignored signals stay ignored across exec
+ *
+ * result - command whose redirections to apply
+ * path - full path of the program
+ * argv - args of the program, null terminated
+ * returns -1 on error, does not return on success
+ */
+static int replace_shell(const struct parse_result *result, const char *path,
+                         char *const argv[]) {
+    if (apply_redirects(result->redirects) < 0) {
+        return -1;
+    }
+    if (!argv[0]) {
+        return 0;
+    }
+
+    // nothing the shell printed may be lost with its buffers
+    fflush(stdout);
+    if (job_control) {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+    }
+    execv(path, argv);
+
+    fprintf(stderr, "ERROR: Could not run %s: %s\n", path, strerror(errno));
+    if (job_control) {
+        init_signal_handlers();
+    }
+    return -1;
+}
+
+static int run_script(const char *path, int tail);
+static pid_t launch_command(struct parse_result *result, const char *path,
+                            pid_t pgid, int in_fd, int out_fd, int isolate);
+static void run_command(struct parse_result *command, int tail);
+static void catch_interrupts(struct sigaction *old);
+static void restore_interrupts(const struct sigaction *old);
+
+/*
+ * runs a builtin in the shell itself with its redirections applied to the
+ * shell's own fds, which are put back once it returns
+ * in_fd and out_fd become stdin and stdout before the redirections apply,
+ * so a builtin in a pipeline reads and writes its pipes the same way
+ *
+ * result - builtin command
+ * in_fd - fd to run it with as stdin
+ * out_fd - fd to run it with as stdout
+ * builtin - function that runs the command
+ * returns what builtin returns, -1 if the redirections fail
+ */
+static int run_redirected(struct parse_result *result, int in_fd, int out_fd,
+                          int (*builtin)(struct parse_result *)) {
+    redirect_t pipe_out = {REDIRECT_DUP, STDOUT_FILENO, out_fd, NULL, 0,
+                           result->redirects};
+    redirect_t pipe_in = {REDIRECT_DUP, STDIN_FILENO, in_fd, NULL, 0,
+                          out_fd != STDOUT_FILENO ? &pipe_out
+                                                  : result->redirects};
+    redirect_t *list = in_fd != STDIN_FILENO ? &pipe_in : pipe_in.next;
+
+    saved_fd_t *saved =
+        arena_alloc(command_arena, (count_redirects(list) + 1) *
+                                       sizeof(saved_fd_t));
+    if (!saved) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return -1;
+    }
+
+    // output buffered for the old stdout must not land in the new one
+    fflush(stdout);
+    if (save_fds(list, saved) < 0) {
+        return -1;
+    }
+    int status = -1;
+    if (apply_redirects(list) == 0) {
+        status = builtin(result);
+    }
+    fflush(stdout);
+    restore_fds(list, saved);
+    return status;
+}
+
+/*
+ * tee builtin, copies its input to its output and to each file
+ * tee -a appends to the files
+ * SIGPIPE is ignored while it runs, since it may run in the shell itself,
+ * and a closed reader just ends the copy; under job control it is always
+ * forked, so it never blocks the shell where ^C and ^Z cannot end it
+ *
+ * result - tee command
+ * returns 1 on success, -1 on error
+ */
+static int tee_builtin(struct parse_result *result) {
+    int append = result->argv[1] && strcmp(result->argv[1], "-a") == 0;
+    char **files = result->argv + 1 + append;
+    size_t count = 0;
+    while (files[count]) {
+        count++;
+    }
+
+    // out_fds[0] is stdout and the rest are the files that opened
+    int *out_fds = arena_alloc(command_arena, (count + 1) * sizeof(int));
+    if (!out_fds) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return -1;
+    }
+
+    int status = 1;
+    int opened = 0;
+    out_fds[opened++] = STDOUT_FILENO;
+    for (size_t i = 0; i < count; i++) {
+        int fd = open(files[i],
+                      O_WRONLY | O_CREAT | O_CLOEXEC |
+                          (append ? O_APPEND : O_TRUNC),
+                      0644);
+        if (fd < 0) {
+            // like tee(1), the other files still get the data
+            perror(files[i]);
+            status = -1;
+        } else {
+            out_fds[opened++] = fd;
+        }
+    }
+
+    fflush(stdout);
+    void (*old_handler)(int) = signal(SIGPIPE, SIG_IGN);
+    if (tee_stream(STDIN_FILENO, out_fds, (size_t)opened) < 0 &&
+        errno != EPIPE) {
+        perror("tee");
+        status = -1;
+    }
+    signal(SIGPIPE, old_handler);
+
+    for (int i = 1; i < opened; i++) {
+        close(out_fds[i]);
+    }
+    return status;
+}
+
+/*
+ * cat builtin, copies each file, or its input for - or no files, to its
+ * output
+ * copy_fd lets the kernel move the data, and SIGPIPE is ignored while it
+ * runs for the same reason as tee
+ *
+ * result - cat command
+ * returns 1 on success, -1 on error
+ */
+static int cat_builtin(struct parse_result *result) {
+    fflush(stdout);
+    void (*old_handler)(int) = signal(SIGPIPE, SIG_IGN);
+    int status = 1;
+    char *stdin_only[] = {"-", NULL};
+    char **files = result->argv[1] ? result->argv + 1 : stdin_only;
+    for (size_t i = 0; files[i]; i++) {
+        int is_stdin = strcmp(files[i], "-") == 0;
+        int fd = is_stdin ? STDIN_FILENO : open(files[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            // like cat(1), the other files are still copied
+            perror(files[i]);
+            status = -1;
+            continue;
+        }
+        int copied = copy_fd(fd, STDOUT_FILENO);
+        if (copied < 0) {
+            // a reader that went away ends the whole copy
+            if (errno == EPIPE) {
+                if (!is_stdin) {
+                    close(fd);
+                }
+                break;
+            }
+            perror(files[i]);
+            status = -1;
+        }
+        if (!is_stdin) {
+            close(fd);
+        }
+    }
+    signal(SIGPIPE, old_handler);
+    return status;
+}
+
+/*
+ * fg and bg builtins, continue a job in the foreground or background
+ *
+ * result - fg or bg command, with the job id parsed from %job
+ * returns 1 on success, -1 on error
+ */
+static int job_builtin(struct parse_result *result) {
+    pid_t pid;
+    process_state_t state;
+
+    // validate job existence
+    if (get_job_info(result->job_id, &pid, &state) < 0) {
+        fprintf(stderr, "ERROR: No such job\n");
+        return -1;
+    }
+
+    if (result->builtin->name[0] == 'f') {
+        // move to fg
+        if (give_terminal_to(pid) < 0 || send_signal_to_job(pid, SIGCONT) < 0) {
+            take_terminal_control();
+            return -1;
+        }
+
+        fg_pid = pid;
+        foreground_job_id = result->job_id;
+        update_job_pid(job_list, pid, RUNNING);
+
+        int status;
+        int wait_result = wait_for_job(pid, &status);
+
+        if (wait_result < 0) {
+            take_terminal_control();
+            return -1;
+        }
+
+        // handle status change for job
+        if (wait_result == 1 && WIFSTOPPED(status)) {
+            fprintf(stdout, "[%d] (%d) suspended by signal %d\n",
+                    result->job_id, pid, WSTOPSIG(status));
+            update_job_pid(job_list, pid, STOPPED);
+        } else if (WIFSIGNALED(status)) {
+            fprintf(stdout, "(%d) terminated by signal %d\n", pid,
+                    WTERMSIG(status));
+            remove_job_jid(job_list, result->job_id);
+        } else {
+            remove_job_jid(job_list, result->job_id);
+        }
+
+        fg_pid = -1;
+        foreground_job_id = -1;
+
+        return take_terminal_control() == 0 ? 1 : -1;
+    }
+
+    // bg
+    if (state != STOPPED) {
+        fprintf(stderr, "ERROR: Job is already running\n");
+        return -1;
+    }
+
+    if (send_signal_to_job(pid, SIGCONT) < 0) {
+        return -1;
+    }
+
+    update_job_pid(job_list, pid, RUNNING);
+    return 1;
+}
+
+/*
+ * exit builtin, exits the shell after killing its jobs
+ */
+static int exit_builtin(struct parse_result *result) {
+    (void)result;
+    cleanup_shell();
+    exit(0);
+}
+
+/*
+ * exec builtin, replaces the shell with a command
+ * exec with only redirections keeps them for the rest of the shell
+ *
+ * result - exec command
+ * returns 1 after applying redirections, -1 on error
+ */
+static int exec_builtin(struct parse_result *result) {
+    const char *path = "";
+    if (result->argv[1] && !(path = resolve_command(result->argv[1]))) {
+        return -1;
+    }
+    return replace_shell(result, path, result->argv + 1) < 0 ? -1 : 1;
+}
+
+/*
+ * jobs builtin, lists the jobs
+ */
+static int jobs_builtin(struct parse_result *result) {
+    (void)result;
+    jobs(job_list);
+    return 1;
+}
+
+/*
+ * cd builtin, changes the working directory
+ */
+static int cd_builtin(struct parse_result *result) {
+    if (chdir(result->argv[1]) < 0) {
+        perror("cd");
+        return -1;
+    }
+    return 1;
+}
+
+/*
+ * ln builtin, makes a hard link
+ */
+static int ln_builtin(struct parse_result *result) {
+    if (link(result->argv[1], result->argv[2]) < 0) {
+        perror("ln");
+        return -1;
+    }
+    return 1;
+}
+
+/*
+ * rm builtin, removes each file
+ * -r removes directories with everything in them through remove_tree,
+ * and -f says nothing about files that do not exist; like rm(1), a file
+ * that cannot be removed does not stop the others
+ * SIGINT stops rm -r, which may be removing a large tree, even where the
+ * shell ignores it for job control
+ *
+ * result - rm command
+ * returns 1 on success, -1 if a file was not removed or it was stopped
+ */
+static int rm_builtin(struct parse_result *result) {
+    int recursive = 0;
+    int force = 0;
+    char **files = result->argv + 1;
+    for (; *files && (*files)[0] == '-' && (*files)[1]; files++) {
+        if (strcmp(*files, "--") == 0) {
+            files++;
+            break;
+        }
+        for (const char *flag = *files + 1; *flag; flag++) {
+            if (*flag == 'r' || *flag == 'R') {
+                recursive = 1;
+            } else if (*flag == 'f') {
+                force = 1;
+            } else {
+                fprintf(stderr, "ERROR: usage: %s\n", result->builtin->usage);
+                return -1;
+            }
+        }
+    }
+    if (!*files && !force) {
+        fprintf(stderr, "ERROR: usage: %s\n", result->builtin->usage);
+        return -1;
+    }
+
+    struct sigaction old;
+    if (recursive) {
+        catch_interrupts(&old);
+    }
+    int status = 1;
+    for (; *files && !(recursive && interrupted); files++) {
+        struct stat st;
+        if (recursive && lstat(*files, &st) == 0 && S_ISDIR(st.st_mode)) {
+            if (remove_tree(*files, force, &interrupted) < 0) {
+                status = -1;
+            }
+        } else if (unlink(*files) < 0 && !(force && errno == ENOENT)) {
+            fprintf(stderr, "rm: %s: %s\n", *files, strerror(errno));
+            status = -1;
+        }
+    }
+    if (recursive) {
+        restore_interrupts(&old);
+        if (interrupted) {
+            status = -1;
+        }
+    }
+    return status;
+}
+
+/*
+ * copies one file for the cp builtin: regular files through copy_file,
+ * which reflinks where the filesystem can, and directories through
+ * copy_tree when recursive
+ *
+ * source - file to copy
+ * dest - path of the copy
+ * recursive - 1 to copy directories
+ * returns 0 on success, -1 after printing an error
+ */
+static int copy_path(const char *source, const char *dest, int recursive) {
+    struct stat st;
+    if (lstat(source, &st) == 0 && S_ISDIR(st.st_mode)) {
+        if (!recursive) {
+            fprintf(stderr, "cp: %s: Is a directory (not copied)\n", source);
+            return -1;
+        }
+        // a copy inside the source would keep finding itself
+        char *real_source = realpath(source, NULL);
+        char *real_parent = NULL;
+        char *slash = strrchr(dest, '/');
+        if (real_source) {
+            char *parent = strndup(dest, slash ? (size_t)(slash - dest) : 0);
+            real_parent = parent && *parent ? realpath(parent, NULL)
+                                            : realpath(slash ? "/" : ".", NULL);
+            free(parent);
+        }
+        size_t length = real_source ? strlen(real_source) : 0;
+        int inside = real_parent && strncmp(real_parent, real_source,
+                                            length) == 0 &&
+                     (real_parent[length] == '/' ||
+                      real_parent[length] == '\0');
+        free(real_source);
+        free(real_parent);
+        if (inside) {
+            fprintf(stderr, "cp: cannot copy %s into itself\n", source);
+            return -1;
+        }
+        return copy_tree(source, dest, &interrupted);
+    }
+
+    int in_fd = open(source, O_RDONLY | O_CLOEXEC);
+    if (in_fd < 0 || fstat(in_fd, &st) < 0) {
+        fprintf(stderr, "cp: %s: %s\n", source, strerror(errno));
+        if (in_fd >= 0) {
+            close(in_fd);
+        }
+        return -1;
+    }
+    struct stat dest_st;
+    if (stat(dest, &dest_st) == 0 && dest_st.st_dev == st.st_dev &&
+        dest_st.st_ino == st.st_ino) {
+        fprintf(stderr, "cp: %s and %s are the same file\n", source, dest);
+        close(in_fd);
+        return -1;
+    }
+    int out_fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      st.st_mode & 0777);
+    int status = 0;
+    if (out_fd < 0) {
+        fprintf(stderr, "cp: %s: %s\n", dest, strerror(errno));
+        status = -1;
+    } else if (copy_file(in_fd, out_fd) < 0) {
+        fprintf(stderr, "cp: %s: %s\n", source, strerror(errno));
+        status = -1;
+    }
+    close(in_fd);
+    if (out_fd >= 0) {
+        close(out_fd);
+    }
+    return status;
+}
+
+/*
+ * cp builtin, copies files
+ * with one source the destination is the copy unless it is a directory;
+ * otherwise each source is copied into the destination under its own name
+ * -r copies directories with everything in them through copy_tree; like
+ * cp(1), a file that cannot be copied does not stop the others
+ * SIGINT stops cp -r, which may be copying a large tree, even where the
+ * shell ignores it for job control
+ *
+ * result - cp command
+ * returns 1 on success, -1 if a file was not copied or it was stopped
+ */
+static int cp_builtin(struct parse_result *result) {
+    int recursive = 0;
+    char **files = result->argv + 1;
+    for (; *files && (*files)[0] == '-' && (*files)[1]; files++) {
+        if (strcmp(*files, "--") == 0) {
+            files++;
+            break;
+        }
+        for (const char *flag = *files + 1; *flag; flag++) {
+            if (*flag == 'r' || *flag == 'R') {
+                recursive = 1;
+            } else {
+                fprintf(stderr, "ERROR: usage: %s\n", result->builtin->usage);
+                return -1;
+            }
+        }
+    }
+    size_t count = 0;
+    while (files[count]) {
+        count++;
+    }
+    if (count < 2) {
+        fprintf(stderr, "ERROR: usage: %s\n", result->builtin->usage);
+        return -1;
+    }
+
+    const char *dest = files[count - 1];
+    struct stat st;
+    int into = stat(dest, &st) == 0 && S_ISDIR(st.st_mode);
+    if (count > 2 && !into) {
+        fprintf(stderr, "cp: %s: Not a directory\n", dest);
+        return -1;
+    }
+    struct sigaction old;
+    if (recursive) {
+        catch_interrupts(&old);
+    }
+    int status = 1;
+    if (!into && copy_path(files[0], dest, recursive) < 0) {
+        status = -1;
+    }
+    for (size_t i = 0; into && i < count - 1 && !(recursive && interrupted);
+         i++) {
+        // the name of the source, leaving out trailing slashes
+        size_t end = strlen(files[i]);
+        while (end > 1 && files[i][end - 1] == '/') {
+            end--;
+        }
+        size_t start = end;
+        while (start > 0 && files[i][start - 1] != '/') {
+            start--;
+        }
+        char *path = NULL;
+        if (asprintf(&path, "%s/%.*s", dest, (int)(end - start),
+                     files[i] + start) < 0) {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            status = -1;
+            break;
+        }
+        if (copy_path(files[i], path, recursive) < 0) {
+            status = -1;
+        }
+        free(path);
+    }
+    if (recursive) {
+        restore_interrupts(&old);
+        if (interrupted) {
+            status = -1;
+        }
+    }
+    return status;
+}
+
+/*
+ * stats builtin, prints cache, arena and launch latency counters
+ */
+static int stats_builtin(struct parse_result *result) {
+    (void)result;
+    printf("parse cache: %lu hits, %lu misses\n", parse_cache_hits,
+           parse_cache_misses);
+    printf("arena: %zu chunk mallocs, %zu in the last line\n",
+           arena_malloc_count(), last_line_mallocs);
+    unsigned long hits;
+    unsigned long misses;
+    get_path_cache_stats(path_cache, &hits, &misses);
+    printf("command cache: %lu hits, %lu misses\n", hits, misses);
+    print_launch_latency();
+    return 1;
+}
+
+/*
+ * hash builtin, lists the command cache
+ * hash -r forgets every path, hash name... looks names up now
+ *
+ * result - hash command
+ * returns 1 on success, -1 if a name was not found
+ */
+static int hash_builtin(struct parse_result *result) {
+    if (!result->argv[1]) {
+        print_path_cache(path_cache);
+        return 1;
+    }
+    if (strcmp(result->argv[1], "-r") == 0) {
+        if (result->argv[2]) {
+            fprintf(stderr, "ERROR: hash -r takes no arguments\n");
+            return -1;
+        }
+        clear_path_cache(path_cache);
+        return 1;
+    }
+
+    int status = 1;
+    for (int i = 1; result->argv[i]; i++) {
+        if (strchr(result->argv[i], '/') || !ensure_path_cache() ||
+            !find_command(path_cache, result->argv[i])) {
+            fprintf(stderr, "ERROR: %s: command not found\n",
+                    result->argv[i]);
+            status = -1;
+        }
+    }
+    return status;
+}
+
+/*
+ * source builtin, runs a script file in the shell itself
+ */
+static int source_builtin(struct parse_result *result) {
+    return run_script(result->argv[1], 0) < 0 ? -1 : 1;
+}
+
+/*
+ * break and continue outside of run_list, as in a pipeline, do nothing
+ */
+static int loop_builtin(struct parse_result *result) {
+    (void)result;
+    return 1;
+}
+
+/*
+ * echo builtin, writes its words with one writev
+ */
+static int echo_builtin(struct parse_result *result) {
+    return echo_words(result->argv + 1) == 0 ? 1 : -1;
+}
+
+/*
+ * printf builtin, writes its arguments with a format
+ */
+static int printf_builtin(struct parse_result *result) {
+    return format_args(result->argv + 1) == 0 ? 1 : -1;
+}
+
+/*
+ * true and false builtins, which only set the exit status
+ */
+static int true_builtin(struct parse_result *result) {
+    (void)result;
+    return 1;
+}
+
+static int false_builtin(struct parse_result *result) {
+    (void)result;
+    return -1;
+}
+
+/*
+ * test and [ builtins, evaluate an expression
+ * [ takes the same expression followed by ]
+ * like test(1), the status is 0 if the expression is true, 1 if it is
+ * false and 2 if it could not be evaluated
+ *
+ * result - test or [ command
+ * returns 1 with last_status set
+ */
+static int test_builtin(struct parse_result *result) {
+    size_t count = 0;
+    while (result->argv[count + 1]) {
+        count++;
+    }
+    if (result->argv[0][0] == '[') {
+        if (count == 0 || strcmp(result->argv[count], "]") != 0) {
+            fprintf(stderr, "[: missing ]\n");
+            last_status = 2;
+            return 1;
+        }
+        count--;
+    }
+    last_status = eval_test(result->argv + 1, count);
+    return 1;
+}
+
+/*
+ * signal handler that records a SIGINT for sleep, watch, rm -r and cp -r
+ * the store is atomic, since the threads of rm -r and cp -r read the flag
+ * too
+ */
+static void catch_interrupt(int sig) {
+    (void)sig;
+    __atomic_store_n(&interrupted, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * makes SIGINT interrupt a wait in the shell instead of being ignored or
+ * killing it, until restore_interrupts puts the old action back
+ * the handler is installed without SA_RESTART, so a blocked read fails
+ * with EINTR
+ *
+ * old - pointer to store the old action
+ */
+static void catch_interrupts(struct sigaction *old) {
+    struct sigaction action;
+    action.sa_handler = catch_interrupt;
+    action.sa_flags = 0;
+    sigemptyset(&action.sa_mask);
+    interrupted = 0;
+    sigaction(SIGINT, &action, old);
+}
+
+static void restore_interrupts(const struct sigaction *old) {
+    sigaction(SIGINT, old, NULL);
+}
+
+/*
+ * makes a command out of the words a builtin such as timeout runs
+ * the builtin's redirections were applied already, so the command has
+ * none of its own
+ *
+ * command - pointer to store the command
+ * result - builtin that runs it
+ * argv - words of the command, null terminated
+ */
+static void init_subcommand(struct parse_result *command,
+                            const struct parse_result *result, char **argv) {
+    *command = *result;
+    command->command_path = argv[0];
+    command->argv = argv;
+    command->redirects = NULL;
+    command->background = 0;
+    command->next = NULL;
+    command->builtin = strchr(argv[0], '/')
+                           ? NULL
+                           : find_builtin(argv[0], strlen(argv[0]));
+}
+
+/*
+ * sleep builtin, waits for the sum of its durations on a timerfd
+ * SIGINT ends the wait early with status 1
+ *
+ * result - sleep command
+ * returns 1 on success, -1 on error or interrupt
+ */
+static int sleep_builtin(struct parse_result *result) {
+    struct timespec total = {0, 0};
+    for (int i = 1; result->argv[i]; i++) {
+        struct timespec duration;
+        if (parse_duration(result->argv[i], &duration) < 0) {
+            return -1;
+        }
+        total.tv_sec += duration.tv_sec;
+        total.tv_nsec += duration.tv_nsec;
+        if (total.tv_nsec >= 1000000000L) {
+            total.tv_sec++;
+            total.tv_nsec -= 1000000000L;
+        }
+    }
+    if (total.tv_sec == 0 && total.tv_nsec == 0) {
+        return 1;
+    }
+
+    int timer = open_timer(&total, NULL);
+    if (timer < 0) {
+        perror("timerfd");
+        return -1;
+    }
+    struct sigaction old;
+    catch_interrupts(&old);
+    long long expiries;
+    while ((expiries = wait_timer(timer)) < 0 && errno == EINTR &&
+           !interrupted) {
+    }
+    restore_interrupts(&old);
+    close(timer);
+    return expiries > 0 ? 1 : -1;
+}
+
+/*
+ * timeout builtin, runs a program and signals its process group when it
+ * runs too long
+ * the program gets a process group of its own; a timerfd and a pidfd of
+ * the program are polled together, and when the timer fires first the
+ * group gets SIGTERM and, after the -k duration, SIGKILL
+ * last_status is the program's, 124 if it timed out, 137 if it had to be
+ * killed, 125 if it could not be watched and 127 if it was not found
+ *
+ * result - timeout command
+ * returns 1 once last_status is set, -1 on usage error
+ */
+static int timeout_builtin(struct parse_result *result) {
+    char **argv = result->argv + 1;
+    struct timespec kill_after = {TIMEOUT_KILL_AFTER, 0};
+    struct timespec duration;
+    if (strcmp(argv[0], "-k") == 0) {
+        if (!argv[1] || parse_duration(argv[1], &kill_after) < 0) {
+            return -1;
+        }
+        argv += 2;
+    }
+    if (!argv[0] || !argv[1]) {
+        fprintf(stderr, "ERROR: usage: %s\n", result->builtin->usage);
+        return -1;
+    }
+    if (parse_duration(argv[0], &duration) < 0) {
+        return -1;
+    }
+
+    struct parse_result command;
+    init_subcommand(&command, result, argv + 1);
+    const char *path = resolve_command(command.command_path);
+    if (!path) {
+        last_status = 127;
+        return 1;
+    }
+    fflush(stdout);
+    pid_t pid = launch_command(&command, path, 0, STDIN_FILENO,
+                               STDOUT_FILENO, 1);
+    if (pid < 0) {
+        last_status = 125;
+        return 1;
+    }
+    fg_pid = pid;
+
+    // a zero duration never arms the timer, so the program is not limited
+    int timer = duration.tv_sec || duration.tv_nsec
+                    ? open_timer(&duration, NULL)
+                    : -1;
+    int pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    int timed_out = 0;
+    if ((timer < 0 && (duration.tv_sec || duration.tv_nsec)) || pidfd < 0) {
+        perror("timeout");
+        send_signal_to_job(pid, SIGKILL);
+        timed_out = -1;
+    }
+    while (timed_out >= 0) {
+        struct pollfd fds[2] = {{pidfd, POLLIN, 0}, {timer, POLLIN, 0}};
+        if (poll(fds, timer < 0 ? 1 : 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+        wait_timer(timer);
+        if (!timed_out) {
+            // a stopped program has to run to handle SIGTERM
+            timed_out = 1;
+            send_signal_to_job(pid, SIGTERM);
+            send_signal_to_job(pid, SIGCONT);
+            close(timer);
+            timer = kill_after.tv_sec || kill_after.tv_nsec
+                        ? open_timer(&kill_after, NULL)
+                        : -1;
+        } else {
+            send_signal_to_job(pid, SIGKILL);
+        }
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    if (timer >= 0) {
+        close(timer);
+    }
+    if (pidfd >= 0) {
+        close(pidfd);
+    }
+    fg_pid = -1;
+    take_terminal_control();
+
+    if (timed_out < 0) {
+        last_status = 125;
+    } else if (WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL) {
+        last_status = 128 + SIGKILL;
+    } else if (timed_out) {
+        last_status = 124;
+    } else if (WIFSIGNALED(status)) {
+        last_status = 128 + WTERMSIG(status);
+    } else {
+        last_status = WEXITSTATUS(status);
+    }
+    return 1;
+}
+
+/*
+ * watch builtin, runs a command every -n seconds until SIGINT
+ * the runs follow a periodic timerfd, so they start on a fixed schedule
+ * however long each takes, and a run that overruns skips the ticks it
+ * missed; builtins such as test run without a fork on every tick
+ * on a terminal the screen is cleared before each run
+ *
+ * result - watch command
+ * returns 1 once last_status is the last run's, -1 on usage error
+ */
+static int watch_builtin(struct parse_result *result) {
+    char **argv = result->argv + 1;
+    struct timespec interval = {WATCH_INTERVAL, 0};
+    if (strcmp(argv[0], "-n") == 0) {
+        if (!argv[1] || parse_duration(argv[1], &interval) < 0) {
             return -1;
         }
-        return 1;
+        argv += 2;
+    }
+    if (!argv[0] || (interval.tv_sec == 0 && interval.tv_nsec == 0)) {
+        fprintf(stderr, "ERROR: usage: %s\n", result->builtin->usage);
+        return -1;
+    }
+
+    struct parse_result command;
+    init_subcommand(&command, result, argv);
+    int timer = open_timer(&interval, &interval);
+    if (timer < 0) {
+        perror("timerfd");
+        return -1;
+    }
+    int clear = isatty(STDOUT_FILENO);
+    struct sigaction old;
+    catch_interrupts(&old);
+    while (!interrupted) {
+        if (clear) {
+            printf("\033[H\033[2J");
+            for (int i = 0; argv[i]; i++) {
+                printf("%s%s", i ? " " : "Every ", argv[i]);
+            }
+            printf("\n\n");
+        }
+        // each run's allocations are freed before the next
+        arena_mark_t mark = arena_mark(command_arena);
+        run_command(&command, 0);
+        arena_release(command_arena, mark);
+        fflush(stdout);
+        if (last_status == 128 + SIGINT) {
+            break;
+        }
+        while (wait_timer(timer) < 0 && errno == EINTR && !interrupted) {
+        }
+    }
+    restore_interrupts(&old);
+    close(timer);
+    return 1;
+}
+
+// slot of a builtin in builtins, from its length and first and last bytes
+// the multipliers were searched for so that no two builtins share a slot;
+// a new builtin that collides is caught by -Woverride-init, and the search
+// has to be run again
+#define BUILTIN_SLOTS 64
+#define BUILTIN_SLOT(length, first, last) \
+    (((length) * 27u + (unsigned)(first) * 19u + (unsigned)(last)) % \
+     BUILTIN_SLOTS)
+
+// perfect hash table of every builtin, looked up by find_builtin
+static const struct builtin builtins[BUILTIN_SLOTS] = {
+    [BUILTIN_SLOT(4, 'e', 't')] = {"exit", exit_builtin, 0, 0, "exit", 0},
+    [BUILTIN_SLOT(4, 'e', 'c')] = {"exec", exec_builtin, 0, -1,
+                                   "exec [command [arg...]]", 0},
+    [BUILTIN_SLOT(4, 'j', 's')] = {"jobs", jobs_builtin, 0, 0, "jobs",
+                                   BUILTIN_BACKGROUND | BUILTIN_REDIRECT},
+    [BUILTIN_SLOT(2, 'c', 'd')] = {"cd", cd_builtin, 1, 1, "cd directory",
+                                   BUILTIN_REDIRECT},
+    [BUILTIN_SLOT(2, 'l', 'n')] = {"ln", ln_builtin, 2, 2,
+                                   "ln source destination",
+                                   BUILTIN_BACKGROUND | BUILTIN_REDIRECT},
+    [BUILTIN_SLOT(2, 'r', 'm')] = {"rm", rm_builtin, 1, -1,
+                                   "rm [-rf] file...",
+                                   BUILTIN_BACKGROUND | BUILTIN_REDIRECT},
+    [BUILTIN_SLOT(2, 'c', 'p')] = {"cp", cp_builtin, 2, -1,
+                                   "cp [-r] source... destination",
+                                   BUILTIN_BACKGROUND | BUILTIN_REDIRECT},
+    [BUILTIN_SLOT(5, 's', 's')] = {"stats", stats_builtin, 0, 0, "stats",
+                                   BUILTIN_BACKGROUND | BUILTIN_REDIRECT},
+    [BUILTIN_SLOT(4, 'h', 'h')] = {"hash", hash_builtin, 0, -1,
+                                   "hash [-r | name...]",
+                                   BUILTIN_BACKGROUND | BUILTIN_REDIRECT},
+    [BUILTIN_SLOT(6, 's', 'e')] = {"source", source_builtin, 1, 1,
+                                   "source file", BUILTIN_REDIRECT},
+    [BUILTIN_SLOT(5, 'b', 'k')] = {"break", loop_builtin, 0, 0, "break",
+                                   BUILTIN_LOOP},
+    [BUILTIN_SLOT(8, 'c', 'e')] = {"continue", loop_builtin, 0, 0,
+                                   "continue", BUILTIN_LOOP},
+    [BUILTIN_SLOT(3, 't', 'e')] = {"tee", tee_builtin, 0, -1,
+                                   "tee [-a] [file...]",
+                                   BUILTIN_BACKGROUND | BUILTIN_REDIRECT |
+                                       BUILTIN_STREAM},
+    [BUILTIN_SLOT(3, 'c', 't')] = {"cat", cat_builtin, 0, -1,
+                                   "cat [file...]",
+                                   BUILTIN_BACKGROUND | BUILTIN_REDIRECT |
+                                       BUILTIN_STREAM},
+    [BUILTIN_SLOT(2, 'f', 'g')] = {"fg", job_builtin, 0, 0, "fg %job",
+                                   BUILTIN_REDIRECT | BUILTIN_JOB},
+    [BUILTIN_SLOT(2, 'b', 'g')] = {"bg", job_builtin, 0, 0, "bg %job",
+                                   BUILTIN_REDIRECT | BUILTIN_JOB},
+    [BUILTIN_SLOT(4, 'e', 'o')] = {"echo", echo_builtin, 0, -1,
+                                   "echo [-neE] [word...]",
+                                   BUILTIN_BACKGROUND | BUILTIN_REDIRECT},
+    [BUILTIN_SLOT(6, 'p', 'f')] = {"printf", printf_builtin, 1, -1,
+                                   "printf format [arg...]",
+                                   BUILTIN_BACKGROUND | BUILTIN_REDIRECT},
+    [BUILTIN_SLOT(4, 't', 'e')] = {"true", true_builtin, 0, -1, "true",
+                                   BUILTIN_BACKGROUND | BUILTIN_REDIRECT},
+    [BUILTIN_SLOT(5, 'f', 'e')] = {"false", false_builtin, 0, -1, "false",
+                                   BUILTIN_BACKGROUND | BUILTIN_REDIRECT},
+    [BUILTIN_SLOT(4, 't', 't')] = {"test", test_builtin, 0, -1,
+                                   "test expression",
+                                   BUILTIN_BACKGROUND | BUILTIN_REDIRECT |
+                                       BUILTIN_STATUS},
+    [BUILTIN_SLOT(1, '[', '[')] = {"[", test_builtin, 0, -1,
+                                   "[ expression ]",
+                                   BUILTIN_BACKGROUND | BUILTIN_REDIRECT |
+                                       BUILTIN_STATUS},
+    [BUILTIN_SLOT(5, 's', 'p')] = {"sleep", sleep_builtin, 1, -1,
+                                   "sleep duration...",
+                                   BUILTIN_BACKGROUND | BUILTIN_REDIRECT},
+    [BUILTIN_SLOT(7, 't', 't')] = {"timeout", timeout_builtin, 2, -1,
+                                   "timeout [-k duration] duration "
+                                   "command [arg...]",
+                                   BUILTIN_BACKGROUND | BUILTIN_REDIRECT |
+                                       BUILTIN_STATUS},
+    [BUILTIN_SLOT(5, 'w', 'h')] = {"watch", watch_builtin, 1, -1,
+                                   "watch [-n duration] command [arg...]",
+                                   BUILTIN_BACKGROUND | BUILTIN_REDIRECT |
+                                       BUILTIN_STATUS},
+};
+
+/*
+ * finds the builtin with a name
+ * costs one hash and one compare, so a program name is rejected as fast
+ * as a builtin is found
+ *
+ * name - command name, which may contain a slash
+ * length - length of name
+ * returns the builtin's descriptor, NULL if name is not a builtin
+ */
+static const struct builtin *find_builtin(const char *name, size_t length) {
+    if (length == 0) {
+        return NULL;
+    }
+    const struct builtin *builtin =
+        &builtins[BUILTIN_SLOT(length, (unsigned char)name[0],
+                               (unsigned char)name[length - 1])];
+    if (!builtin->name || strcmp(builtin->name, name) != 0) {
+        return NULL;
+    }
+    return builtin;
+}
+
+/*
+ * runs a shell built-in command with the shell's fds as they are
+ *
+ * result - pointer to parsed command info
+ * returns 1 if command was handled, 0 if not a builtin, -1 on error
+ */
+static int run_builtin(struct parse_result *result) {
+    const struct builtin *builtin = result->builtin;
+    if (!builtin) {
+        return 0;
+    }
+
+    int args = 0;
+    while (result->argv[args + 1]) {
+        args++;
+    }
+    if (args < builtin->min_args ||
+        (builtin->max_args >= 0 && args > builtin->max_args)) {
+        fprintf(stderr, "ERROR: usage: %s\n", builtin->usage);
+        return -1;
+    }
+    return builtin->run(result);
+}
+
+/*
+ * handles execution of shell built-in commands
+ * a builtin with redirections runs in the shell itself with them applied
+ * to the shell's own fds, which are put back afterwards, so jobs > file
+ * costs no fork; exec applies its own, since they are meant to stay
+ *
+ * result - pointer to parsed command info
+ * returns 1 if command was handled, 0 if not a builtin, -1 on error
+ */
+static int handle_builtin(struct parse_result *result) {
+    if (!result || !result->command_path || !result->argv[0]) {
+        return -1;
+    }
+    if (!result->redirects || !result->builtin ||
+        !(result->builtin->flags & BUILTIN_REDIRECT)) {
+        return run_builtin(result);
+    }
+    return run_redirected(result, STDIN_FILENO, STDOUT_FILENO, run_builtin);
+}
+
+/*
+ * launches an external command with posix_spawn
+ * the child shares the shell's memory until it execs, so launching does not
+ * copy the shell's page tables the way fork does; process group, signal
+ * and redirection setup are described to posix_spawn as attributes and
+ * file actions instead of being run by a forked copy of the shell
+ * with job control the command joins its job's process group, gets default
+ * handlers for the signals the shell ignores and, if it starts a foreground
+ * job, the terminal; without it the child keeps the shell's process group
+ * and signal dispositions, which were never changed
+ *
+ * result - pointer to parsed command info
+ * path - full path of the command to run
+ * pgid - process group to join, 0 to start a new one
+ * in_fd - fd to use as stdin
+ * out_fd - fd to use as stdout
+ * isolate - 1 to start a new process group even without job control, so
+ *           the command can be signalled as a group
+ * returns pid of child, -1 on error
+ */
+static pid_t launch_command(struct parse_result *result, const char *path,
+                            pid_t pgid, int in_fd, int out_fd, int isolate) {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_t *file_actions = NULL;
+    int take_terminal = job_control && !result->background && pgid == 0;
+    int *opened = NULL;  // fds the redirections opened in the shell
+    pid_t pid = -1;
+    int error = 0;
+
+    if ((error = posix_spawnattr_init(&attr)) != 0) {
+        fprintf(stderr, "ERROR: posix_spawnattr_init: %s\n", strerror(error));
+        return -1;
+    }
+
+    if (job_control) {
+        sigset_t defaults;
+        sigemptyset(&defaults);
+        sigaddset(&defaults, SIGINT);
+        sigaddset(&defaults, SIGTSTP);
+        sigaddset(&defaults, SIGTTOU);
+        posix_spawnattr_setsigdefault(&attr, &defaults);
+        posix_spawnattr_setpgroup(&attr, pgid);
+        posix_spawnattr_setflags(&attr,
+                                 POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF);
+    } else if (isolate) {
+        posix_spawnattr_setpgroup(&attr, 0);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    }
+
+    // file actions are only built when there is something to do, which
+    // keeps glibc from allocating them for plain commands
+    if (result->redirects || take_terminal ||
+        in_fd != STDIN_FILENO || out_fd != STDOUT_FILENO) {
+        posix_spawn_file_actions_init(&actions);
+        file_actions = &actions;
+
+        // the child takes the terminal while signals are still blocked
+        // inside posix_spawn, so SIGTTOU cannot stop it
+        if (take_terminal) {
+            error = posix_spawn_file_actions_addtcsetpgrp_np(&actions,
+                                                             STDIN_FILENO);
+        }
+
+        // pipe ends are close-on-exec, so only the copies made here survive
+        // the exec; redirections come after so they win over the pipe
+        if (!error && in_fd != STDIN_FILENO) {
+            error = posix_spawn_file_actions_adddup2(&actions, in_fd,
+                                                     STDIN_FILENO);
+        }
+        if (!error && out_fd != STDOUT_FILENO) {
+            error = posix_spawn_file_actions_adddup2(&actions, out_fd,
+                                                     STDOUT_FILENO);
+        }
+        if (error) {
+            fprintf(stderr, "ERROR: Failed to set up redirections: %s\n",
+                    strerror(error));
+        } else if (result->redirects) {
+            // the files are opened now, so a failure names the file
+            opened = malloc(count_redirects(result->redirects) * sizeof(int));
+            if (!opened) {
+                fprintf(stderr, "ERROR: Out of memory\n");
+                error = -1;
+            } else if (add_redirect_actions(&actions, result->redirects,
+                                            opened) < 0) {
+                error = -1;
+            }
+        }
+    }
+
+    if (!error) {
+        error = posix_spawn(&pid, path, file_actions, &attr, result->argv,
+                            environ);
+        if (error) {
+            fprintf(stderr, "ERROR: Could not run %s: %s\n", path,
+                    strerror(error));
+            pid = -1;
+        }
+    }
+
+    if (opened) {
+        close_redirect_fds(result->redirects, opened);
+        free(opened);
+    }
+    if (file_actions) {
+        posix_spawn_file_actions_destroy(file_actions);
+    }
+    posix_spawnattr_destroy(&attr);
+    return pid;
+}
+
+/*
+ * runs a builtin as one command of a pipeline, in a child of the shell
+ * posix_spawn can only start programs, so this is the one place the shell
+ * still forks
+ *
+ * result - builtin to run
+ * pgid - process group to join, 0 to start a new one
+ * in_fd - fd to use as stdin
+ * out_fd - fd to use as stdout
+ * unused_fds - other pipe ends open in the shell, closed in the child, or
+ *              -1 and the standard fds, which are skipped
+ * returns pid of child, -1 on error
+ */
+static pid_t fork_builtin(struct parse_result *result, pid_t pgid, int in_fd,
+                          int out_fd, const int unused_fds[3]) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid > 0) {
+        // the parent sets the group too, so it exists before the next
+        // command of the pipeline is told to join it
+        if (job_control) {
+            setpgid(pid, pgid);
+        }
+        return pid;
+    }
+
+    if (job_control) {
+        setpgid(0, pgid);
+        if (pgid == 0 && !result->background) {
+            give_terminal_to(getpid());
+        }
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+    }
+    if (in_fd != STDIN_FILENO) {
+        dup2(in_fd, STDIN_FILENO);
+        close(in_fd);
+    }
+    if (out_fd != STDOUT_FILENO) {
+        dup2(out_fd, STDOUT_FILENO);
+        close(out_fd);
+    }
+    for (int i = 0; i < 3; i++) {
+        if (unused_fds[i] > STDERR_FILENO) {
+            close(unused_fds[i]);
+        }
+    }
+
+    // the redirections are applied here once, not again by the builtin
+    struct parse_result applied = *result;
+    applied.redirects = NULL;
+    int status = 1;
+    if (apply_redirects(result->redirects) == 0 &&
+        handle_builtin(&applied) > 0) {
+        status = (result->builtin->flags & BUILTIN_STATUS) ? last_status : 0;
+    }
+    fflush(stdout);
+    _exit(status);
+}
+
+/*
+ * opens a pipe between two commands of a pipeline
+ * both ends are close-on-exec, so only the commands they are handed to keep
+ * them; when PIPESIZE is set, the pipe buffer is resized to that many bytes
+ * so a fast writer does not stall on the default 64 KB
+ *
+ * fds - array to store the read and write ends
+ * returns 0 on success, -1 on error
+ */
+static int open_pipe(int fds[2]) {
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        perror("pipe2");
+        return -1;
+    }
+
+    const char *size = lookup_var("PIPESIZE", strlen("PIPESIZE"));
+    if (size && *size) {
+        char *end;
+        unsigned long bytes = strtoul(size, &end, 10);
+        if (*end != '\0' || bytes == 0 || bytes > INT_MAX) {
+            fprintf(stderr, "ERROR: Invalid PIPESIZE %s\n", size);
+        } else if (fcntl(fds[1], F_SETPIPE_SZ, (int)bytes) < 0) {
+            // the pipe still works with its default size
+            perror("F_SETPIPE_SZ");
+        }
     }
+    return 0;
+}
 
-    if (strcmp(result->argv[0], "rm") == 0) {
-        if (!result->argv[1]) {
-            fprintf(stderr, "ERROR: rm requires a file argument\n");
-            return -1;
+/*
+ * waits for the processes of a foreground job in order
+ * stops early if one of them is stopped, which stops the whole job
+ *
+ * pids - pid of each process, set to 0 as each one is reaped; a command
+ *        the shell ran itself is 0 from the start
+ * count - number of pids
+ * status - pointer to store the status of the last process, or of the one
+ *          that stopped
+ * returns number of processes not yet reaped, -1 on error
+ */
+static int wait_for_processes(pid_t *pids, size_t count, int *status) {
+    for (size_t i = 0; i < count; i++) {
+        if (pids[i] == 0) {
+            continue;
         }
-        if (result->argv[2]) {
-            fprintf(stderr, "ERROR: rm takes only one argument\n");
+        if (waitpid(pids[i], status, WUNTRACED) < 0) {
+            perror("waitpid");
             return -1;
         }
-        if (unlink(result->argv[1]) < 0) {
-            perror("rm");
-            return -1;
+        if (WIFSTOPPED(*status)) {
+            int remaining = 0;
+            for (; i < count; i++) {
+                remaining += pids[i] != 0;
+            }
+            return remaining;
         }
-        return 1;
+        pids[i] = 0;
     }
-
     return 0;
 }
 
 /*
- * primary shell loop that processes commands and manages jobs
- * initializes shell environment, reads and executes commands,
- * and handles process/job control
+ * runs an external command or a pipeline in child processes
+ * the commands of a pipeline are connected by pipes and share one process
+ * group, and builtins in a pipeline run in a forked child
+ * without job control, the first builtin of a foreground pipeline that only
+ * moves data, like tee, runs in the shell itself once the other commands
+ * have started; with job control it is forked, so stopping the job cannot
+ * leave the shell blocked on a pipe
+ * foreground jobs are waited for and given the terminal, background and
+ * stopped jobs are added to the job list as one job
+ * a foreground command that is the last thing the shell will run replaces
+ * the shell instead, which saves the spawn and the wait
  *
- * returns 0 on normal exit, 1 on error
+ * stages - commands of the job, in pipeline order
+ * count - number of commands
+ * tail - 1 if nothing runs after this job
  */
-int main(void) {
-    char buffer[BUFFER_SIZE];
-    struct parse_result result;
-    ssize_t bytes_read;
-
-    // initialize shell environment
-    init_signal_handlers();
+static void run_job(struct parse_result **stages, size_t count, int tail) {
+    struct parse_result *last = stages[count - 1];
+    const char **paths = arena_alloc(command_arena, count * sizeof(char *));
+    pid_t *pids = arena_alloc(command_arena, count * sizeof(pid_t));
+    if (!paths || !pids) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        last_status = 1;
+        return;
+    }
 
-    job_list = init_job_list();
-    if (!job_list) {
-        fprintf(stderr, "Error: Failed to initialize job list\n");
-        return 1;
+    // find every program before starting any of them
+    for (size_t i = 0; i < count; i++) {
+        paths[i] = NULL;
+        if (!stages[i]->builtin &&
+            !(paths[i] = resolve_command(stages[i]->command_path))) {
+            last_status = 127;
+            return;
+        }
     }
 
-    // main loop
-    while (1) {
-        // reap background processes before prompt
-        reap_background_processes();
+    // the shell kills its remaining jobs when it exits, which it could not
+    // do after being replaced
+    if (tail && count == 1 && paths[0] && !last->background &&
+        job_list_empty(job_list)) {
+        replace_shell(last, paths[0], last->argv);
+        last_status = 1;
+        return;
+    }
 
-        // print prompt if compiled with PROMPT defined
-#ifdef PROMPT
-        if (printf("33sh> ") < 0 || fflush(stdout) < 0) {
-            fprintf(stderr, "Error: Failed to display prompt\n");
-            cleanup_job_list(job_list);
-            return 1;
+    size_t in_shell = count;
+    for (size_t i = 0; i < count && !job_control && !last->background; i++) {
+        if (stages[i]->builtin &&
+            (stages[i]->builtin->flags & BUILTIN_STREAM)) {
+            in_shell = i;
+            break;
         }
-#endif
+    }
 
-        bytes_read = read(STDIN_FILENO, buffer, BUFFER_SIZE - 1);
-        if (bytes_read < 0) {
-            perror("read");
-            cleanup_job_list(job_list);
-            return 1;
+    // flush first so shell output comes before the command's
+    fflush(stdout);
+
+    pid_t pgid = 0;
+    size_t launched = 0;
+    int in_fd = STDIN_FILENO;
+    int shell_in = STDIN_FILENO;    // fds of the command the shell runs
+    int shell_out = STDOUT_FILENO;
+    while (launched < count) {
+        int fds[2] = {-1, STDOUT_FILENO};
+        if (launched + 1 < count && open_pipe(fds) < 0) {
+            break;
         }
 
-        // handle EOF
-        if (bytes_read == 0) {
-            cleanup_job_list(job_list);
-            return 0;
+        pid_t pid = 0;
+        struct parse_result *stage = stages[launched];
+        if (launched == in_shell) {
+            // keep its fds open until the shell runs it below
+            shell_in = in_fd;
+            shell_out = fds[1];
+            in_fd = STDIN_FILENO;
+            fds[1] = STDOUT_FILENO;
+        } else if (paths[launched]) {
+            // posix_spawn returns once the child has exec'd, so this times
+            // the whole launch
+            struct timespec start;
+            struct timespec end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            pid = launch_command(stage, paths[launched], pgid, in_fd, fds[1],
+                                 0);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            if (pid >= 0) {
+                record_launch(&start, &end);
+            }
+        } else {
+            int unused_fds[3] = {fds[0], shell_in, shell_out};
+            pid = fork_builtin(stage, pgid, in_fd, fds[1], unused_fds);
         }
 
-        // null terminate and handle newline
-        buffer[bytes_read] = '\0';
-        if (bytes_read > 0 && buffer[bytes_read - 1] == '\n') {
-            buffer[bytes_read - 1] = '\0';
+        // the children have their own copies of the pipe ends now
+        if (in_fd != STDIN_FILENO) {
+            close(in_fd);
         }
-
-        // skip empty lines
-        if (is_empty_or_whitespace(buffer)) {
-            continue;
+        if (fds[1] != STDOUT_FILENO) {
+            close(fds[1]);
         }
+        in_fd = fds[0];
+        if (pid < 0) {
+            break;
+        }
+        pids[launched++] = pid;
+        if (pgid == 0) {
+            pgid = pid;
+        }
+    }
+    if (in_fd >= 0 && in_fd != STDIN_FILENO) {
+        close(in_fd);
+    }
 
-        // parse command
-        if (parse(buffer, &result) < 0) {
-            continue;
+    int shell_status = 0;
+    if (launched == count && in_shell < count) {
+        struct parse_result *stage = stages[in_shell];
+        shell_status =
+            run_redirected(stage, shell_in, shell_out, run_builtin) < 0;
+    }
+    // closing them lets the commands on either side see end of file
+    if (shell_in != STDIN_FILENO) {
+        close(shell_in);
+    }
+    if (shell_out != STDOUT_FILENO) {
+        close(shell_out);
+    }
+
+    if (launched < count) {
+        // the commands that did start may be waiting on the terminal, so
+        // they are stopped rather than left to finish
+        for (size_t i = 0; i < launched; i++) {
+            if (pids[i] > 0) {
+                kill(pids[i], SIGTERM);
+                waitpid(pids[i], NULL, 0);
+            }
         }
+        // the first command may have been given the terminal
+        take_terminal_control();
+        last_status = 1;
+        return;
+    }
 
-        // handle built-ins
-        int builtin_status = handle_builtin(&result);
-        if (builtin_status != 0) {
-            continue;
+    if (!last->background) {
+        // handle fg job
+        pid_t last_pid = pids[count - 1];
+        fg_pid = pgid;
+
+        int status;
+        int remaining = wait_for_processes(pids, count, &status);
+        if (remaining < 0) {
+            last_status = 1;
+        } else if (remaining > 0) {
+            // handle stop, keeping the processes that are still there
+            last_status = 128 + WSTOPSIG(status);
+            if (add_pipeline_job(ensure_job_list(), next_jid, pgid, pids,
+                                 count, STOPPED,
+                                 stages[0]->command_path) == 0) {
+                fprintf(stdout, "[%d] (%d) suspended by signal %d\n",
+                        next_jid, pgid, WSTOPSIG(status));
+                next_jid++;
+            } else {
+                fprintf(stderr, "Error: Failed to add job to job list\n");
+            }
+        } else if (in_shell == count - 1) {
+            last_status = shell_status;
+        } else if (WIFSIGNALED(status)) {
+            last_status = 128 + WTERMSIG(status);
+            fprintf(stdout, "(%d) terminated by signal %d\n", last_pid,
+                    WTERMSIG(status));
+        } else {
+            last_status = WEXITSTATUS(status);
         }
 
-        // fork child
-        pid_t pid = fork();
-        if (pid < 0) {
-            perror("fork");
-            continue;
+        // return terminal to shell
+        fg_pid = -1;
+        take_terminal_control();
+    } else {
+        // handle bg job
+        last_status = 0;
+        if (add_pipeline_job(ensure_job_list(), next_jid, pgid, pids, count,
+                             RUNNING, stages[0]->command_path) == 0) {
+            fprintf(stdout, "[%d] (%d)\n", next_jid, pgid);
+            next_jid++;
+        } else {
+            fprintf(stderr, "Error: Failed to add job to job list\n");
         }
+    }
+}
 
-        if (pid == 0) {  // child
-            if (setpgid(0, 0) < 0) {
-                perror("setpgid");
-                exit(1);
+/*
+ * expands the words of a command that were kept as written
+ * argv[0] and the builtin are taken from the expanded command path again
+ *
+ * command - command with words to expand
+ * expanded - pointer to store the expanded copy, allocated from
+ *            command_arena
+ * returns 0 on success, -1 on allocation failure
+ */
+static int expand_command(const struct parse_result *command,
+                          struct parse_result *expanded) {
+    *expanded = *command;
+    expanded->expand_argv = NULL;
+    expanded->expand_redirects = 0;
+
+    // the redirections are copied so the cached command keeps its words
+    if (command->expand_redirects) {
+        redirect_t **tail = &expanded->redirects;
+        for (const redirect_t *r = command->redirects; r; r = r->next) {
+            redirect_t *copy = arena_alloc(command_arena, sizeof(redirect_t));
+            if (!copy) {
+                return -1;
             }
-
-            // reset sig handlers to default
-            const int signals[] = {SIGINT, SIGTSTP, SIGTTOU};
-            for (int i = 0; i < 3; i++) {
-                if (signal(signals[i], SIG_DFL) == SIG_ERR) {
-                    perror("signal");
-                    exit(1);
-                }
+            *copy = *r;
+            copy->expand = 0;
+            if (r->expand && !(copy->file = expand_word(r->file, command_arena,
+                                                        lookup_var))) {
+                return -1;
             }
+            *tail = copy;
+            tail = &copy->next;
+        }
+    }
+    if (!command->expand_argv) {
+        return 0;
+    }
 
-            // set up terminal control for fg
-            if (!result.background) {
-                if (tcsetpgrp(STDIN_FILENO, getpid()) < 0) {
-                    perror("tcsetpgrp");
-                    exit(1);
-                }
-            }
+    size_t count = 0;
+    while (command->argv[count]) {
+        count++;
+    }
+    expanded->argv = arena_alloc(command_arena, (count + 1) * sizeof(char *));
+    if (!expanded->argv) {
+        return -1;
+    }
+
+    for (size_t i = 1; i < count; i++) {
+        expanded->argv[i] = command->argv[i];
+        if (command->expand_argv[i] &&
+            !(expanded->argv[i] = expand_word(command->argv[i],
+                                              command_arena, lookup_var))) {
+            return -1;
+        }
+    }
+    expanded->argv[0] = command->argv[0];
+    if (command->expand_argv[0]) {
+        // argv[0] only holds what follows the last slash of the word as
+        // written, so the whole word is expanded and split again
+        expanded->command_path = expand_word(command->command_path,
+                                             command_arena, lookup_var);
+        if (!expanded->command_path) {
+            return -1;
+        }
+        expanded->argv[0] = expanded->command_path;
+        char *last_slash = strrchr(expanded->command_path, '/');
+        if (last_slash && command->cmd_type != CMD_ASSIGN) {
+            expanded->argv[0] = last_slash + 1;
+        } else if (command->cmd_type != CMD_ASSIGN) {
+            expanded->builtin = find_builtin(expanded->command_path,
+                                             strlen(expanded->command_path));
+        }
+    }
+    expanded->argv[count] = NULL;
+    return 0;
+}
+
+/*
+ * expands and runs the commands of a pipeline
+ *
+ * first - first command of the pipeline, later ones are linked through next
+ * count - number of commands in the pipeline
+ */
+static void run_pipeline(struct parse_result *first, size_t count) {
+    struct parse_result **stages =
+        arena_alloc(command_arena, count * sizeof(struct parse_result *));
+    struct parse_result *expanded =
+        arena_alloc(command_arena, count * sizeof(struct parse_result));
+    if (!stages || !expanded) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        last_status = 1;
+        return;
+    }
 
-            // set up I/O redirections
-            if (setup_redirections(&result) < 0) {
-                exit(1);
+    struct parse_result *command = first;
+    for (size_t i = 0; i < count; i++, command = command->next) {
+        stages[i] = command;
+        if (command->expand_argv || command->expand_redirects) {
+            if (expand_command(command, &expanded[i]) < 0) {
+                fprintf(stderr, "ERROR: Out of memory\n");
+                last_status = 1;
+                return;
             }
+            stages[i] = &expanded[i];
+        }
+    }
+    run_job(stages, count, 0);
+}
 
-            // execute command
-            execv(result.command_path, result.argv);
-            perror("execv");
-            exit(1);
+/*
+ * runs one command that is not part of a pipeline and sets last_status
+ * builtins run in the shell, except that builtins that can run in the
+ * background are forked like a program when given &, and builtins that
+ * only move data are forked under job control, so ^C and ^Z reach them
+ * instead of the shell, which ignores both
+ *
+ * command - command to run, already expanded
+ * tail - 1 if nothing runs after it, so it may replace the shell
+ */
+static void run_command(struct parse_result *command, int tail) {
+    const struct builtin *builtin = command->builtin;
+    int builtin_status = 0;
+    if (!builtin ||
+        !((command->background && (builtin->flags & BUILTIN_BACKGROUND)) ||
+          (job_control && (builtin->flags & BUILTIN_STREAM)))) {
+        builtin_status = handle_builtin(command);
+    }
+    if (builtin_status == 0) {
+        run_job(&command, 1, tail);
+    } else if (builtin_status < 0 ||
+               !(command->builtin->flags & BUILTIN_STATUS)) {
+        last_status = builtin_status < 0 ? 1 : 0;
+    }
+}
+
+/*
+ * runs a list of commands in order
+ * && and || commands are skipped based on the status of the last command
+ * that ran, so a || b && c runs c if either a or b succeeded
+ * a pipeline runs or is skipped as a whole
+ * words with $ are expanded just before their command runs
+ *
+ * list - first command of the list
+ * tail - 1 if nothing runs after the list, so its last command may
+ *        replace the shell
+ * returns FLOW_BREAK or FLOW_CONTINUE if break or continue ran, FLOW_NEXT
+ * otherwise
+ */
+static enum flow run_list(struct parse_result *list, int tail) {
+    for (struct parse_result *next = list; next; next = next->next) {
+        struct parse_result *first = next;
+        size_t count = 1;
+        while (next->next && next->next->op == LIST_PIPE) {
+            next = next->next;
+            count++;
         }
 
-        // parent
-        if (setpgid(pid, pid) < 0 && errno != EACCES) {
-            perror("setpgid");
+        if ((first->op == LIST_AND && last_status != 0) ||
+            (first->op == LIST_OR && last_status == 0)) {
+            continue;
+        }
+        if (count > 1) {
+            run_pipeline(first, count);
+            continue;
         }
 
-        if (!result.background) {
-            // handle fg process
-            fg_pid = pid;
-            if (tcsetpgrp(STDIN_FILENO, pid) < 0) {
-                perror("tcsetpgrp");
+        struct parse_result expanded;
+        struct parse_result *command = next;
+        if (next->expand_argv || next->expand_redirects) {
+            if (expand_command(next, &expanded) < 0) {
+                fprintf(stderr, "ERROR: Out of memory\n");
+                last_status = 1;
+                continue;
             }
+            command = &expanded;
+        }
 
-            int status;
-            if (waitpid(pid, &status, WUNTRACED) < 0) {
-                perror("waitpid");
+        // handle assignments and loop control, which need the shell itself
+        if (command->cmd_type == CMD_ASSIGN) {
+            char *equals = strchr(command->command_path, '=');
+            if (set_var(command->command_path,
+                        (size_t)(equals - command->command_path),
+                        equals + 1) < 0) {
+                fprintf(stderr, "ERROR: Out of memory\n");
+                last_status = 1;
             } else {
-                // handle status change
-                if (WIFSTOPPED(status)) {
-                    if (add_job(job_list, next_jid, pid, STOPPED,
-                                result.command_path) == 0) {
-                        fprintf(stdout, "[%d] (%d) suspended by signal %d\n",
-                                next_jid, pid, WSTOPSIG(status));
-                        next_jid++;
-                    } else {
-                        fprintf(stderr,
-                                "Error: Failed to add job to job list\n");
-                    }
-                } else if (WIFSIGNALED(status)) {
-                    fprintf(stdout, "(%d) terminated by signal %d\n", pid,
-                            WTERMSIG(status));
-                }
+                last_status = 0;
             }
+            continue;
+        }
+        if (command->builtin && (command->builtin->flags & BUILTIN_LOOP)) {
+            if (command->argv[1]) {
+                fprintf(stderr, "ERROR: %s command takes no arguments\n",
+                        command->argv[0]);
+                last_status = 1;
+                continue;
+            }
+            last_status = 0;
+            return command->command_path[0] == 'b' ? FLOW_BREAK
+                                                   : FLOW_CONTINUE;
+        }
 
-            // return terminal to shell
-            fg_pid = -1;
-            if (tcsetpgrp(STDIN_FILENO, getpgrp()) < 0) {
-                perror("tcsetpgrp");
+        run_command(command, tail && !next->next);
+    }
+    return FLOW_NEXT;
+}
+
+/*
+ * sets a for loop variable to the loop's next word
+ *
+ * for_loop - loop to advance
+ * returns 1 if the variable was set, 0 when no words are left, -1 on error
+ */
+static int for_next(struct for_loop *for_loop) {
+    if (for_loop->index == for_loop->list.count) {
+        return 0;
+    }
+
+    size_t i = for_loop->index++;
+    arena_mark_t mark = arena_mark(command_arena);
+    char *value = for_loop->list.words[i];
+    if (for_loop->list.expand[i]) {
+        value = expand_word(value, command_arena, lookup_var);
+    }
+    int status = (value && set_var(for_loop->name, strlen(for_loop->name),
+                                   value) == 0)
+                     ? 1
+                     : -1;
+    arena_release(command_arena, mark);
+    if (status < 0) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+    }
+    return status;
+}
+
+/*
+ * checks if the word of a case item matches any of its patterns
+ *
+ * item - case item to check
+ * returns 1 on a match, 0 otherwise
+ */
+static int case_matches(const struct case_item *item) {
+    arena_mark_t mark = arena_mark(command_arena);
+    const char *word = item->word;
+    if (item->expand) {
+        word = expand_word(word, command_arena, lookup_var);
+    }
+
+    int matched = 0;
+    for (size_t i = 0; word && !matched && i < item->patterns.count; i++) {
+        const char *pattern = item->patterns.words[i];
+        if (item->patterns.expand[i]) {
+            pattern = expand_word(pattern, command_arena, lookup_var);
+        }
+        matched = pattern && fnmatch(pattern, word, 0) == 0;
+    }
+    arena_release(command_arena, mark);
+    return matched;
+}
+
+/*
+ * runs a compiled program
+ * each command list releases what it allocated before the next
+ * instruction, so loops run in constant arena space
+ *
+ * code - instructions of the program
+ * count - number of instructions
+ */
+static void run_program(const struct instruction *code, size_t count) {
+    size_t pc = 0;
+    while (pc < count) {
+        const struct instruction *instruction = &code[pc++];
+        switch (instruction->op) {
+            case OP_RUN: {
+                reap_background_processes();
+                arena_mark_t mark = arena_mark(command_arena);
+                enum flow flow = run_list(instruction->operand, 0);
+                arena_release(command_arena, mark);
+
+                // break and continue outside a loop do nothing
+                if (flow == FLOW_BREAK && instruction->loop) {
+                    pc = instruction->loop->exit;
+                } else if (flow == FLOW_CONTINUE && instruction->loop) {
+                    pc = instruction->loop->next;
+                }
+                break;
             }
+            case OP_JUMP:
+                pc = instruction->target;
+                break;
+            case OP_JUMP_FALSE:
+                if (last_status != 0) {
+                    pc = instruction->target;
+                }
+                break;
+            case OP_JUMP_TRUE:
+                if (last_status == 0) {
+                    pc = instruction->target;
+                }
+                break;
+            case OP_FOR_INIT:
+                ((struct for_loop *)instruction->operand)->index = 0;
+                last_status = 0;
+                break;
+            case OP_FOR_NEXT:
+                if (for_next(instruction->operand) <= 0) {
+                    pc = instruction->target;
+                }
+                break;
+            case OP_MATCH:
+                if (!case_matches(instruction->operand)) {
+                    pc = instruction->target;
+                }
+                break;
+            case OP_TRUE:
+                last_status = 0;
+                break;
+        }
+    }
+}
+
+/*
+ * parses and runs one line of input
+ * a line with a compound command is compiled along with the lines that
+ * complete it, then run
+ * storage used by the line is released before returning
+ *
+ * source - source the line came from, for lines that continue it
+ * line - null terminated line to run
+ * length - length of line in bytes
+ * tail - 1 if no lines follow this one, so a simple command list may end
+ *        by replacing the shell
+ */
+static void eval_line(struct line_source *source, char *line, size_t length,
+                      int tail) {
+    struct parse_result result;
+    struct parse_cache_entry *entry;
+    size_t mallocs = arena_malloc_count();
+    arena_mark_t mark = arena_mark(command_arena);
+
+    // parse command list, skipping empty lines
+    int parse_status = cached_parse(line, length, &result, &entry);
+    if (parse_status == PARSE_COMPOUND) {
+        struct compiler compiler;
+        if (compile(&compiler, line, length, source) < 0) {
+            last_status = 2;
         } else {
-            // handle bg process
-            if (add_job(job_list, next_jid, pid, RUNNING,
-                        result.command_path) == 0) {
-                fprintf(stdout, "[%d] (%d)\n", next_jid, pid);
-                next_jid++;
-            } else {
-                fprintf(stderr, "Error: Failed to add job to job list\n");
-            }
+            run_program(compiler.code, compiler.count);
         }
+    } else if (parse_status < 0) {
+        last_status = 2;
+    } else if (parse_status == 0) {
+        run_list(&result, tail);
     }
 
-    cleanup_job_list(job_list);
+    if (entry) {
+        entry->in_use--;
+    }
+    arena_release(command_arena, mark);
+    last_line_mallocs = arena_malloc_count() - mallocs;
+}
+
+/*
+ * checks if text has nothing but whitespace left
+ *
+ * text - start of text
+ * end - end of text
+ */
+static int only_blanks(const char *text, const char *end) {
+    while (text < end && (*text == ' ' || *text == '\t' || *text == '\n')) {
+        text++;
+    }
+    return text >= end;
+}
+
+/*
+ * runs each line of a block of text in place
+ *
+ * text - start of text, modified in place
+ * size - length of text in bytes
+ * terminated - 1 if text[size] is a null terminator, 0 if there may be no
+ *              room after the text
+ * tail - 1 if the shell exits after the text, so its last command may
+ *        replace the shell
+ */
+static void run_lines(char *text, size_t size, int terminated, int tail) {
+    struct line_source source = {NULL, text, text + size, terminated, NULL};
+    char *line;
+    ssize_t length;
+
+    while ((length = next_line(&source, &line, 0)) >= 0) {
+        reap_background_processes();
+        eval_line(&source, line, (size_t)length,
+                  tail && only_blanks(source.text, source.end));
+    }
+    free(source.tail);
+}
+
+/*
+ * runs every line of a script file
+ * the file is mapped privately and its lines are parsed in place
+ *
+ * path - path to script file
+ * tail - 1 if the shell exits after the script, so its last command may
+ *        replace the shell
+ * returns 0 on success, -1 if the file could not be read
+ */
+static int run_script(const char *path, int tail) {
+    if (script_depth >= MAX_SCRIPT_DEPTH) {
+        fprintf(stderr, "ERROR: source nested too deeply\n");
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    size_t size = (size_t)st.st_size;
+    char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    script_depth++;
+    run_lines(map, size, 0, tail);
+    script_depth--;
+
+    munmap(map, size);
+    return 0;
+}
+
+/*
+ * primary shell loop that processes commands and manages jobs
+ * initializes shell environment, reads and executes commands,
+ * and handles process/job control
+ * job control is on only when stdin is a terminal
+ * with -c, runs the command string and exits without a prompt, signal
+ * setup or job control
+ * with a script argument, runs the script instead of reading stdin
+ *
+ * returns 0 on normal exit, 1 on error, or the status of the last command
+ * in -c and script mode
+ */
+int main(int argc, char **argv) {
+    struct line_source source = {NULL, NULL, NULL, 0, NULL};
+    char *buffer;
+    ssize_t line_length;
+    char *command_string = NULL;
+
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "%s: -c requires an argument\n", argv[0]);
+            return 2;
+        }
+        command_string = argv[2];
+    } else if (argc > 2) {
+        fprintf(stderr, "usage: %s [-c command | script]\n", argv[0]);
+        return 2;
+    }
+
+    // job control only applies when stdin is a terminal; batch input from a
+    // pipe or file takes the plain launch path
+    if (!command_string && isatty(STDIN_FILENO)) {
+        job_control = 1;
+    }
+
+    // initialize shell environment
+    // the job list is allocated when the first job is added
+    if (job_control) {
+        init_signal_handlers();
+    }
+
+    command_arena = init_arena(ARENA_CHUNK_SIZE);
+    if (!command_arena) {
+        fprintf(stderr, "Error: Failed to initialize command arena\n");
+        return 1;
+    }
+
+    // command string mode
+    if (command_string) {
+        run_lines(command_string, strlen(command_string), 1, 1);
+        cleanup_shell();
+        return last_status;
+    }
+
+    // script mode
+    if (argc == 2) {
+        int script_status = run_script(argv[1], 1);
+        cleanup_shell();
+        return script_status < 0 ? 1 : last_status;
+    }
+
+    source.reader = init_line_reader(STDIN_FILENO);
+    if (!source.reader) {
+        fprintf(stderr, "Error: Failed to initialize input reader\n");
+        cleanup_shell();
+        return 1;
+    }
+
+    // main loop
+    while (1) {
+        // reap background processes before prompt
+        reap_background_processes();
+
+        // print prompt if compiled with PROMPT defined
+#ifdef PROMPT
+        if (printf("33sh> ") < 0 || fflush(stdout) < 0) {
+            fprintf(stderr, "Error: Failed to display prompt\n");
+            cleanup_line_reader(source.reader);
+            cleanup_shell();
+            return 1;
+        }
+#endif
+
+        // one line per iteration; the reader keeps any lines that arrived
+        // in the same read for the next pass
+        line_length = next_line(&source, &buffer, 0);
+        if (line_length == -2) {
+            cleanup_line_reader(source.reader);
+            cleanup_shell();
+            return 1;
+        }
+
+        // handle EOF
+        if (line_length == -1) {
+            cleanup_line_reader(source.reader);
+            cleanup_shell();
+            return 0;
+        }
+
+        eval_line(&source, buffer, (size_t)line_length, 0);
+    }
+
+    cleanup_line_reader(source.reader);
+    cleanup_shell();
     return 0;
-}
\ No newline at end of file
+}
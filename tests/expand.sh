@@ -0,0 +1,18 @@
+#!/bin/bash
+# variable expansion in the command word and its arguments
+. "$(dirname "$0")/lib.bash"
+
+mkdir "$TMP/bin"
+printf '#!/bin/sh\necho "prog $*"\n' > "$TMP/bin/prog"
+chmod +x "$TMP/bin/prog"
+
+echo "expand:"
+check "variable argument" "a b" 0 'V=b
+echo a $V'
+check "variable directory of a command" "prog x" 0 "D=$TMP/bin
+\$D/prog x"
+check "variable name of a command" "prog y" 0 "C=prog
+$TMP/bin/\$C y"
+check "variable builtin" "hi" 0 'E=echo
+$E hi'
+finish
@@ -0,0 +1,50 @@
+#!/bin/bash
+# ^C and ^Z with the shell on a terminal, which script(1) provides
+. "$(dirname "$0")/lib.bash"
+
+echo "job control:"
+if ! command -v script > /dev/null; then
+    echo "  skip  script(1) is not installed"
+    check_keys "interrupt tee" "status 130" 'tee\n' '\003' 'echo status $?\n' \
+    'exit\n'
+check_keys "stop tee" '\[1\] \([0-9]+\) Stopped tee' 'tee -a out\n' \
+    '\032' 'jobs\n' 'exit\n'
+finish
+fi
+
+# types each key sequence after a pause, so the command typed before it
+# is running when it arrives, and prints what the terminal showed
+type_keys() {
+    for keys; do
+        sleep 0.5
+        printf "$keys"
+    done | (cd "$TMP" && timeout 10 script -qfec "$SH" /dev/null) |
+        tr -d '\r'
+}
+
+# usage: check_keys name expected_line_regex keys...
+check_keys() {
+    local name=$1 expected=$2
+    shift 2
+    local output
+    output=$(type_keys "$@")
+    if grep -qxE "$expected" <<< "$output"; then
+        echo "  ok    $name"
+    else
+        echo "  FAIL  $name"
+        echo "        expected a line: $expected"
+        echo "        got:"
+        printf '%s\n' "$output" | sed 's/^/          /'
+        FAILED=1
+    fi
+}
+
+check_keys "interrupt cat" "status 130" 'cat\n' '\003' 'echo status $?\n' \
+    'exit\n'
+check_keys "stop cat" '\[1\] \([0-9]+\) Stopped cat' 'cat\n' '\032' \
+    'jobs\n' 'exit\n'
+check_keys "interrupt tee" "status 130" 'tee\n' '\003' 'echo status $?\n' \
+    'exit\n'
+check_keys "stop tee" '\[1\] \([0-9]+\) Stopped tee' 'tee -a out\n' \
+    '\032' 'jobs\n' 'exit\n'
+finish
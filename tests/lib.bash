@@ -0,0 +1,35 @@
+# helpers shared by the test scripts, which make test runs from the repo
+# root; SH picks the shell under test
+
+ROOT=$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)
+SH=${SH:-$ROOT/33noprompt}
+FAILED=0
+
+# a scratch directory for the script, removed when it exits
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# runs lines on the shell's stdin and compares what it prints on stdout
+# and stderr together, and its exit status
+# usage: check name expected_output expected_status lines
+check() {
+    local name=$1 expected=$2 expected_status=$3 lines=$4
+    local output status
+    output=$(cd "$TMP" && printf '%s\n' "$lines" | "$SH" 2>&1)
+    status=$?
+    if [[ $output == "$expected" && $status == "$expected_status" ]]; then
+        echo "  ok    $name"
+    else
+        echo "  FAIL  $name"
+        echo "        expected status $expected_status, output:"
+        printf '%s\n' "$expected" | sed 's/^/          /'
+        echo "        got status $status, output:"
+        printf '%s\n' "$output" | sed 's/^/          /'
+        FAILED=1
+    fi
+}
+
+# exits with the result of every check so far
+finish() {
+    exit $FAILED
+}
@@ -0,0 +1,45 @@
+#!/bin/bash
+# the command cache noticing PATH directories change
+. "$(dirname "$0")/lib.bash"
+
+printf '#!/bin/sh\necho foo ran\n' > "$TMP/foo.sh"
+chmod +x "$TMP/foo.sh"
+mkdir "$TMP/pd"
+
+echo "path cache:"
+PATH="$TMP/pd:/usr/bin:/bin" check \
+    "command added to a watched directory" \
+    "ERROR: foo: command not found
+foo ran" 0 "foo
+/bin/cp $TMP/foo.sh $TMP/pd/foo
+foo"
+/bin/rm -f "$TMP/pd/foo"
+PATH="$TMP/later:/usr/bin:/bin" check \
+    "command added to a directory that did not exist" \
+    "ERROR: foo: command not found
+foo ran" 0 "foo
+/bin/mkdir $TMP/later
+/bin/cp $TMP/foo.sh $TMP/later/foo
+foo"
+/bin/rm -rf "$TMP/later"
+PATH="$TMP/pd:/usr/bin:/bin" check \
+    "command added to a directory deleted and made again" \
+    "ERROR: foo: command not found
+ERROR: foo: command not found
+foo ran" 0 "foo
+/bin/rm -r $TMP/pd
+/bin/mkdir $TMP/pd
+foo
+/bin/cp $TMP/foo.sh $TMP/pd/foo
+foo"
+PATH="/usr/bin:/bin" check "PATH assignment" \
+    "ERROR: foo: command not found
+foo ran
+$TMP/pd:/usr/bin:/bin
+ERROR: foo: command not found" 0 "foo
+PATH=$TMP/pd:\$PATH
+foo
+printenv PATH
+PATH=/usr/bin:/bin
+foo"
+finish
@@ -0,0 +1,20 @@
+#!/bin/bash
+# redirections of programs, which posix_spawn applies, and of builtins
+. "$(dirname "$0")/lib.bash"
+
+echo "redirect:"
+check "program input missing" "missing: No such file or directory
+1" 0 "/bin/cat < missing
+echo \$?"
+check "program output in a missing directory" \
+    "missing/out: No such file or directory
+1" 0 "/bin/echo hi > missing/out
+echo \$?"
+check "builtin input missing" "missing: No such file or directory
+1" 0 "cat < missing
+echo \$?"
+check "program output to a file" "hi" 0 "/bin/echo hi > out
+cat out"
+check "file opened after fds the list names" "hi" 0 "/bin/echo hi 3>&1 4>out2 1>&4
+cat out2"
+finish
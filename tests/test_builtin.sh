@@ -0,0 +1,23 @@
+#!/bin/bash
+# exit statuses of the test and [ builtins
+. "$(dirname "$0")/lib.bash"
+
+echo "test builtin:"
+check "true expression" "0" 0 "test a = a
+echo \$?"
+check "false expression" "1" 0 "[ a = b ]
+echo \$?"
+check "integer expected" "test: x: integer expression expected
+2" 0 "test 1 -eq x
+echo \$?"
+check "unexpected argument" "test: b: unexpected argument
+2" 0 "test a b
+echo \$?"
+check "missing ]" "[: missing ]
+2
+[: missing ]
+2" 0 "[ a = a
+echo \$?
+[
+echo \$?"
+finish
@@ -0,0 +1,43 @@
+#!/bin/bash
+# rm -r and cp -r on large trees
+. "$(dirname "$0")/lib.bash"
+
+# fills a directory with dirs directories of files files each
+make_tree() {
+    local dir=$1 dirs=$2 files=$3
+    mkdir "$dir"
+    for d in $(seq "$dirs"); do
+        mkdir "$dir/$d"
+        (cd "$dir/$d" && touch $(seq "$files"))
+    done
+}
+
+# runs a command on the shell and sends it SIGINT once the command has
+# changed the directory watched, which starts with entries entries
+# usage: check_interrupt name command watched entries
+check_interrupt() {
+    local name=$1 command=$2 watched=$3 entries=$4
+    local output
+    output=$(printf '%s\necho status $?\n' "$command" | "$SH" 2>&1 &
+             pid=$!
+             while [[ $(ls "$watched" 2> /dev/null | wc -l) == "$entries" ]]
+             do
+                 sleep 0.01
+             done
+             kill -INT "$pid"
+             wait)
+    if [[ $output == "status 1" && -d $watched ]]; then
+        echo "  ok    $name"
+    else
+        echo "  FAIL  $name"
+        echo "        expected status 1 and $watched left, got:"
+        printf '%s\n' "$output" | sed 's/^/          /'
+        FAILED=1
+    fi
+}
+
+echo "tree:"
+make_tree "$TMP/big" 200 250
+check_interrupt "interrupt cp -r" "cp -r $TMP/big $TMP/copy" "$TMP/copy" 0
+check_interrupt "interrupt rm -r" "rm -r $TMP/big" "$TMP/big" 200
+finish
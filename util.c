@@ -0,0 +1,815 @@
+#include "./util.h"
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define OUTPUT_SIZE 4096  // bytes printf collects before writing them
+#define SPEC_SIZE 32      // longest conversion spec kept, with length
+
+// output collected by printf and echo -e, written when full
+struct output {
+    char data[OUTPUT_SIZE];
+    size_t used;
+    int error;  // 1 once a write failed
+};
+
+/*
+ * writes every byte of a list of buffers, retrying short writes
+ * iov is changed to track what is left
+ *
+ * fd - fd to write
+ * iov - buffers to write
+ * count - number of buffers
+ * returns 0 on success, -1 on error with errno set
+ */
+static int write_all(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        int batch = count < IOV_MAX ? count : IOV_MAX;
+        ssize_t written = writev(fd, iov, batch);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        size_t left = (size_t)written;
+        while (count > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+    return 0;
+}
+
+/*
+ * writes what an output has collected to stdout
+ * stdio's own buffer goes first so builtins that print with it stay in
+ * order
+ */
+static void flush_output(struct output *out) {
+    fflush(stdout);
+    struct iovec iov = {out->data, out->used};
+    if (out->used && !out->error && write_all(STDOUT_FILENO, &iov, 1) < 0) {
+        perror("write");
+        out->error = 1;
+    }
+    out->used = 0;
+}
+
+/*
+ * adds bytes to an output, writing it when full
+ */
+static void put_bytes(struct output *out, const char *bytes, size_t length) {
+    while (length > 0) {
+        if (out->used == OUTPUT_SIZE) {
+            flush_output(out);
+        }
+        size_t room = OUTPUT_SIZE - out->used;
+        size_t n = length < room ? length : room;
+        memcpy(out->data + out->used, bytes, n);
+        out->used += n;
+        bytes += n;
+        length -= n;
+    }
+}
+
+/*
+ * adds one byte to an output
+ */
+static void put_byte(struct output *out, char c) {
+    put_bytes(out, &c, 1);
+}
+
+/*
+ * adds the byte a backslash escape stands for
+ * echo -e and %b write octal as \0nnn, a printf format as \nnn
+ *
+ * out - output to add to
+ * p - pointer to the byte after the backslash, moved past the escape
+ * zero_octal - 1 if octal escapes start with \0
+ * returns 1 for \c, which ends all output, 0 otherwise
+ */
+static int put_escape(struct output *out, const char **p, int zero_octal) {
+    static const char names[] = "abefnrtv\\";
+    static const char bytes[] = "\a\b\033\f\n\r\t\v\\";
+    const char *s = *p;
+    char c = *s;
+    const char *name = c ? strchr(names, c) : NULL;
+    if (c == 'c') {
+        *p = s + 1;
+        return 1;
+    }
+    if (name) {
+        put_byte(out, bytes[name - names]);
+        s++;
+    } else if (c >= '0' && c <= '7') {
+        // the 0 of \0nnn is not one of its digits
+        int value = 0;
+        int digits = 0;
+        if (zero_octal && c == '0') {
+            s++;
+        }
+        while (digits < 3 && *s >= '0' && *s <= '7') {
+            value = value * 8 + (*s++ - '0');
+            digits++;
+        }
+        put_byte(out, (char)value);
+    } else {
+        // unknown escapes and a trailing backslash are written as is
+        put_byte(out, '\\');
+    }
+    *p = s;
+    return 0;
+}
+
+/*
+ * adds a string to an output with its backslash escapes replaced
+ *
+ * returns 1 if \c ended the output, 0 otherwise
+ */
+static int put_escaped(struct output *out, const char *s, int zero_octal) {
+    while (*s) {
+        const char *backslash = strchr(s, '\\');
+        size_t length = backslash ? (size_t)(backslash - s) : strlen(s);
+        put_bytes(out, s, length);
+        s += length;
+        if (backslash) {
+            s++;
+            if (put_escape(out, &s, zero_octal)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * writes the words of echo to stdout, separated by spaces
+ * -n leaves out the newline and -e turns on backslash escapes; without
+ * escapes the words are written straight from argv with one writev
+ *
+ * argv - echo's arguments after its name, null terminated
+ * returns 0 on success, 1 on write error
+ */
+int echo_words(char **argv) {
+    int newline = 1;
+    int escapes = 0;
+    // options are only taken while every letter is one echo knows
+    for (; *argv && (*argv)[0] == '-' && (*argv)[1]; argv++) {
+        const char *letter = *argv + 1;
+        while (*letter == 'n' || *letter == 'e' || *letter == 'E') {
+            letter++;
+        }
+        if (*letter) {
+            break;
+        }
+        for (letter = *argv + 1; *letter; letter++) {
+            if (*letter == 'n') {
+                newline = 0;
+            } else {
+                escapes = *letter == 'e';
+            }
+        }
+    }
+
+    if (escapes) {
+        struct output out = {.used = 0, .error = 0};
+        int stopped = 0;
+        for (size_t i = 0; argv[i] && !stopped; i++) {
+            if (i > 0) {
+                put_byte(&out, ' ');
+            }
+            stopped = put_escaped(&out, argv[i], 1);
+        }
+        if (newline && !stopped) {
+            put_byte(&out, '\n');
+        }
+        flush_output(&out);
+        return out.error;
+    }
+
+    size_t count = 0;
+    while (argv[count]) {
+        count++;
+    }
+    // a word and the space or newline after it per pair of buffers
+    struct iovec stack_iov[64];
+    struct iovec *iov = stack_iov;
+    if (count * 2 > sizeof(stack_iov) / sizeof(stack_iov[0]) &&
+        !(iov = malloc(count * 2 * sizeof(struct iovec)))) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return 1;
+    }
+    int used = 0;
+    for (size_t i = 0; i < count; i++) {
+        iov[used].iov_base = argv[i];
+        iov[used++].iov_len = strlen(argv[i]);
+        if (i + 1 < count || newline) {
+            iov[used].iov_base = i + 1 < count ? " " : "\n";
+            iov[used++].iov_len = 1;
+        }
+    }
+    if (count == 0 && newline) {
+        iov[used].iov_base = "\n";
+        iov[used++].iov_len = 1;
+    }
+
+    fflush(stdout);
+    int status = 0;
+    if (write_all(STDOUT_FILENO, iov, used) < 0) {
+        perror("echo");
+        status = 1;
+    }
+    if (iov != stack_iov) {
+        free(iov);
+    }
+    return status;
+}
+
+/*
+ * converts a printf argument to a number
+ * 'c and "c give the value of the byte c, as printf(1) allows
+ *
+ * arg - argument, or NULL when they ran out, which is 0
+ * is_unsigned - 1 to read it as unsigned
+ * error - set to 1 if the argument is not a number
+ * returns the number, as much of it as was read on error
+ */
+static intmax_t to_number(const char *arg, int is_unsigned, int *error) {
+    if (!arg || !*arg) {
+        return 0;
+    }
+    if (arg[0] == '\'' || arg[0] == '"') {
+        return (unsigned char)arg[1];
+    }
+    char *end;
+    errno = 0;
+    intmax_t value = is_unsigned ? (intmax_t)strtoumax(arg, &end, 0)
+                                 : strtoimax(arg, &end, 0);
+    if (end == arg || *end || errno) {
+        fprintf(stderr, "printf: %s: invalid number\n", arg);
+        *error = 1;
+    }
+    return value;
+}
+
+/*
+ * formats one conversion with snprintf
+ *
+ * buffer - where to write it
+ * size - size of buffer
+ * spec - conversion spec taking width and precision as arguments
+ * width - field width
+ * precision - precision, negative if there is none, unused by %c
+ * conversion - conversion letter
+ * arg - argument, NULL when they ran out
+ * error - set to 1 if a number was expected and arg is not one
+ * returns the length of the result, as snprintf does
+ */
+static int format_one(char *buffer, size_t size, const char *spec,
+                      int width, int precision, char conversion,
+                      const char *arg, int *error) {
+    if (conversion == 's') {
+        return snprintf(buffer, size, spec, width, precision, arg ? arg : "");
+    }
+    if (conversion == 'c') {
+        // an empty argument writes a null byte, as printf(1) does
+        return snprintf(buffer, size, spec, width, arg ? arg[0] : '\0');
+    }
+    int is_unsigned = conversion != 'd' && conversion != 'i';
+    return snprintf(buffer, size, spec, width, precision,
+                    to_number(arg, is_unsigned, error));
+}
+
+/*
+ * adds one conversion to an output
+ * arguments are as format_one takes them
+ */
+static void put_formatted(struct output *out, const char *spec, int width,
+                          int precision, char conversion, const char *arg,
+                          int *error) {
+    char buffer[512];
+    int length = format_one(buffer, sizeof(buffer), spec, width, precision,
+                            conversion, arg, error);
+    if (length < 0) {
+        return;
+    }
+    if ((size_t)length < sizeof(buffer)) {
+        put_bytes(out, buffer, (size_t)length);
+        return;
+    }
+
+    // a wide field or long string does not fit the buffer
+    char *text = malloc((size_t)length + 1);
+    if (!text) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        *error = 1;
+        return;
+    }
+    int ignored = 0;
+    format_one(text, (size_t)length + 1, spec, width, precision, conversion,
+               arg, &ignored);
+    put_bytes(out, text, (size_t)length);
+    free(text);
+}
+
+/*
+ * reads a width or precision, which is a number or * for the next argument
+ *
+ * p - pointer into the format, moved past the number
+ * args - pointer to the next argument, moved past one used by *
+ * error - set to 1 if * took an argument that is not a number
+ * returns the value, -1 if there was none
+ */
+static int read_field(const char **p, char ***args, int *error) {
+    if (**p == '*') {
+        (*p)++;
+        const char *arg = **args;
+        if (arg) {
+            (*args)++;
+        }
+        intmax_t value = to_number(arg, 0, error);
+        return value > INT_MAX ? INT_MAX : value < INT_MIN ? INT_MIN
+                                                           : (int)value;
+    }
+    if (!isdigit((unsigned char)**p)) {
+        return -1;
+    }
+    int value = 0;
+    while (isdigit((unsigned char)**p)) {
+        if (value < INT_MAX / 10) {
+            value = value * 10 + (**p - '0');
+        }
+        (*p)++;
+    }
+    return value;
+}
+
+/*
+ * writes arguments to stdout as printf(1) does
+ * the format is reused until every argument is consumed, and supports
+ * flags, width and precision, * for either, the conversions
+ * d i o u x X c s b and %%, and backslash escapes
+ *
+ * argv - format followed by its arguments, null terminated
+ * returns 0 on success, 1 if an argument was not a number or on write error
+ */
+int format_args(char **argv) {
+    if (!argv[0]) {
+        fprintf(stderr, "ERROR: usage: printf format [arg...]\n");
+        return 1;
+    }
+    struct output out = {.used = 0, .error = 0};
+    const char *format = argv[0];
+    char **args = argv + 1;
+    int error = 0;
+    int stopped = 0;
+
+    do {
+        char **start = args;
+        const char *p = format;
+        while (*p && !stopped) {
+            if (*p == '\\') {
+                p++;
+                stopped = put_escape(&out, &p, 0);
+                continue;
+            }
+            if (*p != '%') {
+                const char *next = strpbrk(p, "\\%");
+                size_t length = next ? (size_t)(next - p) : strlen(p);
+                put_bytes(&out, p, length);
+                p += length;
+                continue;
+            }
+            if (p[1] == '%') {
+                put_byte(&out, '%');
+                p += 2;
+                continue;
+            }
+
+            // the spec always takes width and precision as arguments,
+            // so the ones written in the format can be checked first; a
+            // negative precision counts as none, as in printf(3)
+            char spec[SPEC_SIZE];
+            size_t used = 0;
+            spec[used++] = '%';
+            p++;
+            while (*p && strchr("-+ #0", *p) && used < SPEC_SIZE - 8) {
+                spec[used++] = *p++;
+            }
+            int star = *p == '*';
+            int width = read_field(&p, &args, &error);
+            if (width < 0 && star) {
+                // a negative * width left-justifies
+                spec[used++] = '-';
+                width = width == INT_MIN ? INT_MAX : -width;
+            } else if (width < 0) {
+                width = 0;
+            }
+            int precision = -1;
+            if (*p == '.') {
+                p++;
+                star = *p == '*';
+                precision = read_field(&p, &args, &error);
+                if (precision < 0 && !star) {
+                    precision = 0;
+                }
+            }
+
+            char conversion = *p;
+            if (!conversion || !strchr("diouxXcsb", conversion)) {
+                fprintf(stderr, "printf: %%%c: invalid conversion\n",
+                        conversion ? conversion : ' ');
+                error = 1;
+                stopped = 1;
+                break;
+            }
+            p++;
+            const char *arg = *args;
+            if (arg) {
+                args++;
+            }
+
+            if (conversion == 'b') {
+                // %b writes its argument with echo -e escapes
+                stopped = put_escaped(&out, arg ? arg : "", 1);
+                continue;
+            }
+            spec[used++] = '*';
+            if (conversion != 'c') {
+                spec[used++] = '.';
+                spec[used++] = '*';
+            }
+            if (conversion != 's' && conversion != 'c') {
+                spec[used++] = 'j';
+            }
+            spec[used++] = conversion;
+            spec[used] = '\0';
+            put_formatted(&out, spec, width, precision, conversion, arg,
+                          &error);
+        }
+        // a format that takes no arguments is written once
+        if (args == start) {
+            break;
+        }
+    } while (*args && !stopped);
+
+    flush_output(&out);
+    return error || out.error;
+}
+
+/*
+ * reads a test argument as an integer
+ *
+ * returns 0 on success, -1 after printing an error
+ */
+static int test_number(const char *arg, long long *value) {
+    char *end;
+    errno = 0;
+    *value = strtoll(arg, &end, 10);
+    while (end != arg && isspace((unsigned char)*end)) {
+        end++;
+    }
+    if (end == arg || *end || errno) {
+        fprintf(stderr, "test: %s: integer expression expected\n", arg);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * checks if a word is a unary test operator
+ */
+static int is_unary(const char *word) {
+    return word[0] == '-' && word[1] && !word[2] &&
+           strchr("nzefdrwxsLhbcpSt", word[1]);
+}
+
+/*
+ * checks if a word is a binary test operator
+ */
+static int is_binary(const char *word) {
+    static const char *const ops[] = {"=",   "==",  "!=",  "<",   ">",
+                                      "-eq", "-ne", "-lt", "-le", "-gt",
+                                      "-ge", "-nt", "-ot", "-ef"};
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (strcmp(word, ops[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * evaluates a unary test
+ *
+ * returns 1 if true, 0 if false, -1 after printing an error
+ */
+static int unary_test(char op, const char *arg) {
+    struct stat st;
+    if (op == 'n' || op == 'z') {
+        return (arg[0] != '\0') == (op == 'n');
+    }
+    if (op == 'r' || op == 'w' || op == 'x') {
+        return access(arg, op == 'r' ? R_OK : op == 'w' ? W_OK : X_OK) == 0;
+    }
+    if (op == 't') {
+        long long fd;
+        if (test_number(arg, &fd) < 0) {
+            return -1;
+        }
+        return fd >= 0 && fd <= INT_MAX && isatty((int)fd);
+    }
+    if (op == 'L' || op == 'h') {
+        return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (stat(arg, &st) < 0) {
+        return 0;
+    }
+    if (op == 'f') {
+        return S_ISREG(st.st_mode);
+    }
+    if (op == 'd') {
+        return S_ISDIR(st.st_mode);
+    }
+    if (op == 's') {
+        return st.st_size > 0;
+    }
+    if (op == 'b') {
+        return S_ISBLK(st.st_mode);
+    }
+    if (op == 'c') {
+        return S_ISCHR(st.st_mode);
+    }
+    if (op == 'p') {
+        return S_ISFIFO(st.st_mode);
+    }
+    if (op == 'S') {
+        return S_ISSOCK(st.st_mode);
+    }
+    return 1;  // -e
+}
+
+/*
+ * checks if file a was modified after file b, or a exists and b does not
+ */
+static int newer(const char *a, const char *b) {
+    struct stat sa;
+    struct stat sb;
+    if (stat(a, &sa) < 0) {
+        return 0;
+    }
+    if (stat(b, &sb) < 0) {
+        return 1;
+    }
+    return sa.st_mtim.tv_sec > sb.st_mtim.tv_sec ||
+           (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec &&
+            sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec);
+}
+
+/*
+ * evaluates a binary test
+ *
+ * returns 1 if true, 0 if false, -1 after printing an error
+ */
+static int binary_test(const char *left, const char *op, const char *right) {
+    if (op[0] != '-') {
+        int order = strcmp(left, right);
+        return op[0] == '!' ? order != 0
+               : op[0] == '<' ? order < 0
+               : op[0] == '>' ? order > 0
+                              : order == 0;
+    }
+    if (strcmp(op, "-nt") == 0) {
+        return newer(left, right);
+    }
+    if (strcmp(op, "-ot") == 0) {
+        return newer(right, left);
+    }
+    if (strcmp(op, "-ef") == 0) {
+        struct stat a;
+        struct stat b;
+        return stat(left, &a) == 0 && stat(right, &b) == 0 &&
+               a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+    }
+
+    long long a;
+    long long b;
+    if (test_number(left, &a) < 0 || test_number(right, &b) < 0) {
+        return -1;
+    }
+    if (strcmp(op, "-eq") == 0) {
+        return a == b;
+    }
+    if (strcmp(op, "-ne") == 0) {
+        return a != b;
+    }
+    if (strcmp(op, "-lt") == 0) {
+        return a < b;
+    }
+    if (strcmp(op, "-le") == 0) {
+        return a <= b;
+    }
+    if (strcmp(op, "-gt") == 0) {
+        return a > b;
+    }
+    return a >= b;
+}
+
+// words of a test expression being evaluated
+struct test_words {
+    char **words;
+    size_t count;
+    size_t next;
+};
+
+static int test_or(struct test_words *t);
+
+/*
+ * evaluates a primary: ( expression ), a unary or binary test, or a
+ * string, which is true if it is not empty
+ * with three words left a binary operator in the middle wins, as POSIX
+ * asks, so test -n = -n compares strings
+ *
+ * returns 1 if true, 0 if false, -1 on error
+ */
+static int test_primary(struct test_words *t) {
+    size_t left = t->count - t->next;
+    char **w = t->words + t->next;
+    if (left == 0) {
+        fprintf(stderr, "test: argument expected\n");
+        return -1;
+    }
+    if (left >= 3 && is_binary(w[1])) {
+        t->next += 3;
+        return binary_test(w[0], w[1], w[2]);
+    }
+    if (strcmp(w[0], "(") == 0 && left >= 2) {
+        t->next++;
+        int value = test_or(t);
+        if (value < 0) {
+            return -1;
+        }
+        if (t->next == t->count || strcmp(t->words[t->next], ")") != 0) {
+            fprintf(stderr, "test: missing )\n");
+            return -1;
+        }
+        t->next++;
+        return value;
+    }
+    if (left >= 2 && is_unary(w[0])) {
+        t->next += 2;
+        return unary_test(w[0][1], w[1]);
+    }
+    t->next++;
+    return w[0][0] != '\0';
+}
+
+/*
+ * evaluates ! primary, or a primary
+ */
+static int test_not(struct test_words *t) {
+    if (t->count - t->next >= 2 && strcmp(t->words[t->next], "!") == 0) {
+        t->next++;
+        int value = test_not(t);
+        return value < 0 ? -1 : !value;
+    }
+    return test_primary(t);
+}
+
+/*
+ * evaluates not-expressions joined by -a
+ */
+static int test_and(struct test_words *t) {
+    int value = test_not(t);
+    while (value >= 0 && t->next < t->count &&
+           strcmp(t->words[t->next], "-a") == 0) {
+        t->next++;
+        int right = test_not(t);
+        value = right < 0 ? -1 : value && right;
+    }
+    return value;
+}
+
+/*
+ * evaluates and-expressions joined by -o
+ */
+static int test_or(struct test_words *t) {
+    int value = test_and(t);
+    while (value >= 0 && t->next < t->count &&
+           strcmp(t->words[t->next], "-o") == 0) {
+        t->next++;
+        int right = test_and(t);
+        value = right < 0 ? -1 : value || right;
+    }
+    return value;
+}
+
+/*
+ * evaluates a test(1) expression: ! ( ) -a -o, the string tests -n -z
+ * = != < >, the integer tests -eq -ne -lt -le -gt -ge, the file tests
+ * -e -f -d -r -w -x -s -L -h -b -c -p -S -t and -nt -ot -ef
+ *
+ * argv - expression, null terminated
+ * count - number of words in argv
+ * returns 0 if true, 1 if false, 2 after printing an error
+ */
+int eval_test(char **argv, size_t count) {
+    if (count == 0) {
+        return 1;
+    }
+    struct test_words t = {argv, count, 0};
+    int value = test_or(&t);
+    if (value >= 0 && t.next < t.count) {
+        fprintf(stderr, "test: %s: unexpected argument\n", argv[t.next]);
+        return 2;
+    }
+    return value < 0 ? 2 : !value;
+}
+
+/*
+ * parses a duration such as 5, 0.25 or 1.5m
+ * the suffix s, m, h or d gives the unit, seconds when there is none
+ *
+ * text - duration to parse
+ * duration - pointer to store it
+ * returns 0 on success, -1 after printing an error
+ */
+int parse_duration(const char *text, struct timespec *duration) {
+    static const char units[] = "smhd";
+    static const double seconds_per_unit[] = {1, 60, 3600, 86400};
+    char *end;
+    errno = 0;
+    double seconds = strtod(text, &end);
+    const char *unit = *end ? strchr(units, *end) : units;
+    if (end == text || !isdigit((unsigned char)text[0]) || errno || !unit ||
+        (*end && end[1])) {
+        fprintf(stderr, "ERROR: Invalid duration %s\n", text);
+        return -1;
+    }
+    seconds *= seconds_per_unit[unit - units];
+    if (!(seconds < (double)INT_MAX)) {
+        fprintf(stderr, "ERROR: Duration %s is too long\n", text);
+        return -1;
+    }
+    duration->tv_sec = (time_t)seconds;
+    duration->tv_nsec = (long)((seconds - (double)duration->tv_sec) * 1e9);
+    return 0;
+}
+
+/*
+ * opens a timerfd on CLOCK_MONOTONIC that first expires after value and
+ * then every interval, if interval is not NULL
+ * a periodic timer keeps its schedule however late it is read, so a loop
+ * that waits on it does not drift
+ *
+ * value - time to the first expiry, which must not be zero
+ * interval - time between later expiries, NULL for a one-shot timer
+ * returns the timer's fd, close-on-exec, or -1 on error with errno set
+ */
+int open_timer(const struct timespec *value, const struct timespec *interval) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct itimerspec spec = {{0, 0}, *value};
+    if (interval) {
+        spec.it_interval = *interval;
+    }
+    if (timerfd_settime(fd, 0, &spec, NULL) < 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * waits for a timer opened by open_timer to expire
+ *
+ * fd - timer to wait on
+ * returns the number of expiries since the last wait, -1 on error with
+ * errno set, which is EINTR if a signal handler ran
+ */
+long long wait_timer(int fd) {
+    uint64_t expiries;
+    if (read(fd, &expiries, sizeof(expiries)) < 0) {
+        return -1;
+    }
+    return (long long)expiries;
+}
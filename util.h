@@ -0,0 +1,70 @@
+#ifndef UTIL_H_
+#define UTIL_H_
+
+#include <stddef.h>
+#include <time.h>
+
+/*
+ * writes the words of echo to stdout, separated by spaces
+ * -n leaves out the newline and -e turns on backslash escapes; without
+ * escapes the words are written straight from argv with one writev
+ *
+ * argv - echo's arguments after its name, null terminated
+ * returns 0 on success, 1 on write error
+ */
+int echo_words(char **argv);
+
+/*
+ * writes arguments to stdout as printf(1) does
+ * the format is reused until every argument is consumed, and supports
+ * flags, width and precision, * for either, the conversions
+ * d i o u x X c s b and %%, and backslash escapes
+ *
+ * argv - format followed by its arguments, null terminated
+ * returns 0 on success, 1 if an argument was not a number or on write error
+ */
+int format_args(char **argv);
+
+/*
+ * evaluates a test(1) expression: ! ( ) -a -o, the string tests -n -z
+ * = != < >, the integer tests -eq -ne -lt -le -gt -ge, the file tests
+ * -e -f -d -r -w -x -s -L -h -b -c -p -S -t and -nt -ot -ef
+ *
+ * argv - expression, null terminated
+ * count - number of words in argv
+ * returns 0 if true, 1 if false, 2 after printing an error
+ */
+int eval_test(char **argv, size_t count);
+
+/*
+ * parses a duration such as 5, 0.25 or 1.5m
+ * the suffix s, m, h or d gives the unit, seconds when there is none
+ *
+ * text - duration to parse
+ * duration - pointer to store it
+ * returns 0 on success, -1 after printing an error
+ */
+int parse_duration(const char *text, struct timespec *duration);
+
+/*
+ * opens a timerfd on CLOCK_MONOTONIC that first expires after value and
+ * then every interval, if interval is not NULL
+ * a periodic timer keeps its schedule however late it is read, so a loop
+ * that waits on it does not drift
+ *
+ * value - time to the first expiry, which must not be zero
+ * interval - time between later expiries, NULL for a one-shot timer
+ * returns the timer's fd, close-on-exec, or -1 on error with errno set
+ */
+int open_timer(const struct timespec *value, const struct timespec *interval);
+
+/*
+ * waits for a timer opened by open_timer to expire
+ *
+ * fd - timer to wait on
+ * returns the number of expiries since the last wait, -1 on error with
+ * errno set, which is EINTR if a signal handler ran
+ */
+long long wait_timer(int fd);
+
+#endif  // UTIL_H_